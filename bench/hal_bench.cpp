@@ -0,0 +1,722 @@
+// Benchmark of the single pattern searches
+//
+// The searches of hal_search (pattern_search_t with its tables built at
+// every call, compiled_pattern_t with its tables built once) against the
+// searchers of the standard library, memmem and a memchr + memcmp loop.
+// Every engine counts all the matches of a pattern in a buffer, restarting
+// one byte after each match like the table pass. The patterns are cut from
+// the buffer, so each one is found at least once.
+//
+// The buffers are synthetic, from the lowest to the highest entropy, and
+// the files given on the command line. For each pattern length the rates
+// are in GB/s of buffer scanned, with the matches per MB: at a high match
+// rate the cost of a restart dominates. Below the rates, the candidates per
+// MB of each engine: the positions where it compared the pattern, counted
+// in a separate run so the counting does not slow the measure. The
+// searchers of the standard library compare the window from its last byte,
+// a comparison with the last pattern byte starts a candidate; memmem hides
+// its candidates.
+//
+// hal_bench [-s size_mb] [file...]
+// hal_bench -c: the cross checks against a naive search, see run_checks()
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <pro.h>
+
+#include "hal_search.hpp"
+
+#if defined(__GLIBC__) || defined(__APPLE__) || defined(__FreeBSD__)
+#define BENCH_HAVE_MEMMEM
+#endif
+
+#define BENCH_SIZE_MB       8           // size of the synthetic buffers
+#define BENCH_MIN_MS        100         // min time of a measure
+#define BENCH_MAX_FILE_MB   64          // max bytes read from a file
+
+static const size_t pattern_lengths[] =
+{
+    1, 2, 4, 8, 16, 32, 64, 128, 256, 512, 1024, 2048, 4096, 8192,
+};
+
+struct buffer_t
+{
+    std::string name;
+    qvector<uchar> bytes;
+};
+
+//--------------------------------------------------------------------------
+// Synthetic buffers
+//
+static uint32 bench_rand(uint32 *state)
+{
+    // xorshift32
+    uint32 x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+// mostly zero, with short runs of 4 values: padding and sparse tables
+static void make_low_entropy(buffer_t &b, size_t size, uint32 *state)
+{
+    b.name = "low entropy";
+    b.bytes.resize(size);
+    for (size_t i = 0; i < size; i++)
+    {
+        uint32 r = bench_rand(state);
+        b.bytes[i] = (r & 0xF0) < 0xC0 ? 0 : (uchar) (r & 3);
+    }
+}
+
+// words of lower case letters and spaces: strings and resources
+static void make_text(buffer_t &b, size_t size, uint32 *state)
+{
+    b.name = "text";
+    b.bytes.resize(size);
+    for (size_t i = 0; i < size; i++)
+    {
+        uint32 r = bench_rand(state);
+        b.bytes[i] = (r % 6) == 0 ? ' ' : (uchar) ('a' + (r >> 8) % 26);
+    }
+}
+
+// small values and a few frequent opcodes, like code and integer tables
+static void make_skewed(buffer_t &b, size_t size, uint32 *state)
+{
+    static const uchar frequent[] = { 0x00, 0xFF, 0x48, 0x89, 0x8B, 0xE8, 0x0F, 0x24 };
+    b.name = "skewed";
+    b.bytes.resize(size);
+    for (size_t i = 0; i < size; i++)
+    {
+        uint32 r = bench_rand(state);
+        switch (r & 3)
+        {
+            case 0:
+            case 1:
+                b.bytes[i] = frequent[(r >> 8) & 7];
+                break;
+            case 2:
+                b.bytes[i] = (uchar) ((r >> 8) & 0x1F);
+                break;
+            default:
+                b.bytes[i] = (uchar) (r >> 8);
+                break;
+        }
+    }
+}
+
+// uniform bytes: compressed and encrypted data
+static void make_random(buffer_t &b, size_t size, uint32 *state)
+{
+    b.name = "random";
+    b.bytes.resize(size);
+    for (size_t i = 0; i < size; i++)
+    {
+        b.bytes[i] = (uchar) (bench_rand(state) >> 8);
+    }
+}
+
+static bool read_file(buffer_t &b, const char *path)
+{
+    FILE *fp = fopen(path, "rb");
+    if (nullptr == fp)
+    {
+        return false;
+    }
+
+    b.name = path;
+    b.bytes.resize((size_t) BENCH_MAX_FILE_MB << 20);
+    size_t n = fread(b.bytes.begin(), 1, b.bytes.size(), fp);
+    fclose(fp);
+    b.bytes.resize(n);
+    return n != 0;
+}
+
+// Shannon entropy in bits per byte
+static double get_entropy(const qvector<uchar> &bytes)
+{
+    size_t counts[256] = { 0 };
+    for (size_t i = 0; i < bytes.size(); i++)
+    {
+        counts[bytes[i]]++;
+    }
+
+    double h = 0;
+    for (size_t c = 0; c < 256; c++)
+    {
+        if (0 != counts[c])
+        {
+            double p = (double) counts[c] / bytes.size();
+            h -= p * log2(p);
+        }
+    }
+    return h;
+}
+
+//--------------------------------------------------------------------------
+// Engines
+//
+// the number of matches of the pattern in the buffer, a match is searched
+// again one byte after the previous one. If pCandidates is not null, it
+// receives the number of candidates, NO_CANDIDATES when unknown
+typedef std::function<size_t(const uchar *pSrc, size_t iSrcLen, size_t *pCandidates)> counter_t;
+
+#define NO_CANDIDATES   ((size_t) -1)
+
+struct engine_t
+{
+    const char *name;
+    counter_t (*make)(const uchar *pPattern, size_t iPatternLen);
+};
+
+static counter_t make_hal(const uchar *pPattern, size_t iPatternLen)
+{
+    return [pPattern, iPatternLen](const uchar *pSrc, size_t iSrcLen, size_t *pCandidates)
+    {
+        pattern_search_t search;
+        const size_t start = hal_search_candidates;
+        size_t n = 0;
+        for (size_t off = 0; off < iSrcLen; )
+        {
+            ssize_t pos = search.search(pSrc + off, iSrcLen - off, pPattern, iPatternLen, 0);
+            if (pos < 0)
+            {
+                break;
+            }
+            n++;
+            off += pos + 1;
+        }
+        if (nullptr != pCandidates)
+        {
+            *pCandidates = hal_search_candidates - start;
+        }
+        return n;
+    };
+}
+
+static counter_t make_compiled(const uchar *pPattern, size_t iPatternLen)
+{
+    std::shared_ptr<compiled_pattern_t> pat(new compiled_pattern_t);
+    pat->compile(pPattern, iPatternLen, 1);
+    return [pat](const uchar *pSrc, size_t iSrcLen, size_t *pCandidates)
+    {
+        const size_t start = hal_search_candidates;
+        size_t n = 0;
+        for (size_t off = 0; off < iSrcLen; )
+        {
+            ssize_t pos = pat->search(pSrc + off, iSrcLen - off);
+            if (pos < 0)
+            {
+                break;
+            }
+            n++;
+            off += pos + 1;
+        }
+        if (nullptr != pCandidates)
+        {
+            *pCandidates = hal_search_candidates - start;
+        }
+        return n;
+    };
+}
+
+// byte equality counting the comparisons with the last pattern byte
+struct counting_equal_t
+{
+    const uchar *last;
+    size_t *count;
+
+    bool operator()(const uchar &a, const uchar &b) const
+    {
+        if (&b == last)
+        {
+            (*count)++;
+        }
+        return a == b;
+    }
+};
+
+template <class Searcher>
+static size_t count_std(const Searcher &searcher, const uchar *pSrc, size_t iSrcLen)
+{
+    const uchar *end = pSrc + iSrcLen;
+    size_t n = 0;
+    for (const uchar *p = pSrc; p < end; )
+    {
+        const uchar *found = searcher(p, end).first;
+        if (found == end)
+        {
+            break;
+        }
+        n++;
+        p = found + 1;
+    }
+    return n;
+}
+
+// Searcher<const uchar *> for the measure, the same searcher with the
+// counting equality for the candidates
+template <template <class, class, class> class Searcher>
+static counter_t make_std(const uchar *pPattern, size_t iPatternLen)
+{
+    typedef Searcher<const uchar *, std::hash<uchar>, std::equal_to<> > plain_t;
+    typedef Searcher<const uchar *, std::hash<uchar>, counting_equal_t> counted_t;
+
+    std::shared_ptr<size_t> count(new size_t(0));
+    counting_equal_t equal = { pPattern + iPatternLen - 1, count.get() };
+    plain_t searcher(pPattern, pPattern + iPatternLen);
+    counted_t counted(pPattern, pPattern + iPatternLen, std::hash<uchar>(), equal);
+    return [searcher, counted, count](const uchar *pSrc, size_t iSrcLen, size_t *pCandidates)
+    {
+        if (nullptr == pCandidates)
+        {
+            return count_std(searcher, pSrc, iSrcLen);
+        }
+        *count = 0;
+        size_t n = count_std(counted, pSrc, iSrcLen);
+        *pCandidates = *count;
+        return n;
+    };
+}
+
+#ifdef BENCH_HAVE_MEMMEM
+static counter_t make_memmem(const uchar *pPattern, size_t iPatternLen)
+{
+    return [pPattern, iPatternLen](const uchar *pSrc, size_t iSrcLen, size_t *pCandidates)
+    {
+        if (nullptr != pCandidates)
+        {
+            *pCandidates = NO_CANDIDATES;
+        }
+        const uchar *end = pSrc + iSrcLen;
+        size_t n = 0;
+        for (const uchar *p = pSrc; p < end; )
+        {
+            const uchar *found = (const uchar *) memmem(p, end - p, pPattern, iPatternLen);
+            if (nullptr == found)
+            {
+                break;
+            }
+            n++;
+            p = found + 1;
+        }
+        return n;
+    };
+}
+#endif
+
+static counter_t make_memchr(const uchar *pPattern, size_t iPatternLen)
+{
+    return [pPattern, iPatternLen](const uchar *pSrc, size_t iSrcLen, size_t *pCandidates)
+    {
+        size_t n = 0, candidates = 0;
+        if (nullptr != pCandidates)
+        {
+            *pCandidates = 0;
+        }
+        if (iSrcLen < iPatternLen)
+        {
+            return n;
+        }
+
+        // the last start of a match, within the buffer
+        const uchar *last = pSrc + iSrcLen - iPatternLen;
+        for (const uchar *p = pSrc; p <= last; )
+        {
+            const uchar *found = (const uchar *) memchr(p, pPattern[0], last - p + 1);
+            if (nullptr == found)
+            {
+                break;
+            }
+            candidates++;
+            if (0 == memcmp(found + 1, pPattern + 1, iPatternLen - 1))
+            {
+                n++;
+            }
+            p = found + 1;
+        }
+        if (nullptr != pCandidates)
+        {
+            *pCandidates = candidates;
+        }
+        return n;
+    };
+}
+
+static const engine_t engines[] =
+{
+    { "hal",        make_hal },
+    { "compiled",   make_compiled },
+    { "std bmh",    make_std<std::boyer_moore_horspool_searcher> },
+    { "std bm",     make_std<std::boyer_moore_searcher> },
+#ifdef BENCH_HAVE_MEMMEM
+    { "memmem",     make_memmem },
+#endif
+    { "memchr",     make_memchr },
+};
+
+//--------------------------------------------------------------------------
+// GB/s of the engine, *pMatches and *pCandidates receive its counts
+static double measure(const engine_t &engine, const buffer_t &b, const uchar *pPattern, size_t iPatternLen,
+                      size_t *pMatches, size_t *pCandidates)
+{
+    typedef std::chrono::steady_clock bench_clock_t;
+    counter_t count = engine.make(pPattern, iPatternLen);
+    count(b.bytes.begin(), b.bytes.size(), pCandidates);
+
+    size_t runs = 0;
+    double ms = 0;
+    bench_clock_t::time_point start = bench_clock_t::now();
+    do
+    {
+        *pMatches = count(b.bytes.begin(), b.bytes.size(), nullptr);
+        runs++;
+        ms = std::chrono::duration<double, std::milli>(bench_clock_t::now() - start).count();
+    }
+    while (ms < BENCH_MIN_MS);
+
+    return (double) b.bytes.size() * runs / (ms * 1e6);
+}
+
+static void run_buffer(const buffer_t &b, uint32 *state)
+{
+    printf("\n%s: %.1f MB, %.2f bits/byte\n", b.name.c_str(), b.bytes.size() / 1048576.0, get_entropy(b.bytes));
+    printf("%6s %10s", "len", "match/MB");
+    for (size_t e = 0; e < qnumber(engines); e++)
+    {
+        printf(" %9s", engines[e].name);
+    }
+    printf("   GB/s\n");
+
+    for (size_t i = 0; i < qnumber(pattern_lengths); i++)
+    {
+        const size_t m = pattern_lengths[i];
+        if (m > b.bytes.size())
+        {
+            break;
+        }
+
+        const uchar *pat = b.bytes.begin() + bench_rand(state) % (b.bytes.size() - m + 1);
+        size_t expected = 0;
+        bool mismatch = false;
+        double rates[qnumber(engines)];
+        size_t candidates[qnumber(engines)];
+        for (size_t e = 0; e < qnumber(engines); e++)
+        {
+            size_t matches;
+            rates[e] = measure(engines[e], b, pat, m, &matches, &candidates[e]);
+            if (0 == e)
+            {
+                expected = matches;
+            }
+            else if (matches != expected)
+            {
+                fprintf(stderr, "%s: %s found %d matches of %d bytes, hal %d\n",
+                        b.name.c_str(), engines[e].name, (int) matches, (int) m, (int) expected);
+                mismatch = true;
+            }
+        }
+
+        printf("%6d %10.1f", (int) m, expected / (b.bytes.size() / 1048576.0));
+        for (size_t e = 0; e < qnumber(engines); e++)
+        {
+            printf(" %9.2f", rates[e]);
+        }
+        printf("%s\n", mismatch ? "   MISMATCH" : "");
+
+        printf("%6s %10s", "", "cand/MB");
+        for (size_t e = 0; e < qnumber(engines); e++)
+        {
+            if (NO_CANDIDATES == candidates[e])
+            {
+                printf(" %9s", "-");
+            }
+            else
+            {
+                printf(" %9.0f", candidates[e] / (b.bytes.size() / 1048576.0));
+            }
+        }
+        printf("\n");
+    }
+}
+
+//--------------------------------------------------------------------------
+// Cross checks
+//
+// hal_bench -c: the searches not measured above against a naive search, on
+// small random buffers of 4 byte values so the matches are frequent: the
+// wide elements of pattern_search_t and compiled_pattern_t, search_masked
+// and the stream search, exact, masked or wide, fed in chunks of random
+// sizes. The mismatches are
+// printed, the exit status tells if there was one.
+
+#define CHECK_ROUNDS        2000        // random cases per check
+#define CHECK_MAX_SIZE      8192        // max bytes of a buffer
+
+// random buffer of CHECK_MAX_SIZE bytes at most, and a pattern cut from it
+// at a multiple of iAlign, one byte changed at times
+static void make_case(qvector<uchar> &buf, qvector<uchar> &pat, size_t iMaxLen, size_t iAlign, uint32 *state)
+{
+    buf.resize(1 + bench_rand(state) % CHECK_MAX_SIZE);
+    for (size_t i = 0; i < buf.size(); i++)
+    {
+        buf[i] = (uchar) (bench_rand(state) & 3);
+    }
+
+    size_t m = 1 + bench_rand(state) % qmin(iMaxLen, buf.size());
+    m = qmax(iAlign, m - m % iAlign);
+    if (m > buf.size())
+    {
+        m = iAlign;
+        buf.resize(qmax(buf.size(), m));
+    }
+    size_t off = bench_rand(state) % (buf.size() - m + 1);
+    off -= off % iAlign;
+    pat.resize(m);
+    memcpy(pat.begin(), buf.begin() + off, m);
+    if (0 == (bench_rand(state) & 3))
+    {
+        pat[bench_rand(state) % m] ^= 1;
+    }
+}
+
+// offsets of all the matches at the multiples of iAlign, pMask may be null
+static void naive_matches(std::vector<size_t> &out, const qvector<uchar> &buf, const uchar *pPattern,
+                          const uchar *pMask, size_t iPatternLen, size_t iAlign)
+{
+    out.clear();
+    for (size_t off = 0; off + iPatternLen <= buf.size(); off += iAlign)
+    {
+        size_t i = 0;
+        while (i < iPatternLen && 0 == ((buf[off + i] ^ pPattern[i]) & (nullptr != pMask ? pMask[i] : 0xFF)))
+        {
+            i++;
+        }
+        if (i == iPatternLen)
+        {
+            out.push_back(off);
+        }
+    }
+}
+
+// all the matches of a search restarted iAlign bytes after each one
+template <class Search>
+static void all_matches(std::vector<size_t> &out, const qvector<uchar> &buf, size_t iAlign, Search search)
+{
+    out.clear();
+    for (size_t off = 0; off < buf.size(); )
+    {
+        ssize_t pos = search(buf.begin() + off, (ssize_t) (buf.size() - off));
+        if (pos < 0)
+        {
+            break;
+        }
+        out.push_back(off + pos);
+        off += pos + iAlign;
+    }
+}
+
+static bool report(const char *name, size_t iRound, size_t iPatternLen, const std::vector<size_t> &found,
+                   const std::vector<size_t> &expected)
+{
+    if (found == expected)
+    {
+        return true;
+    }
+    fprintf(stderr, "%s: round %d, pattern of %d bytes: %d matches, naive %d\n",
+            name, (int) iRound, (int) iPatternLen, (int) found.size(), (int) expected.size());
+    return false;
+}
+
+template <class T>
+static size_t check_wide(uint32 *state)
+{
+    qvector<uchar> buf, pat;
+    std::vector<T> words;
+    std::vector<size_t> found, expected;
+    size_t bad = 0;
+    for (size_t r = 0; r < CHECK_ROUNDS; r++)
+    {
+        make_case(buf, pat, 64 * sizeof(T), sizeof(T), state);
+        const ssize_t count = pat.size() / sizeof(T);
+        words.resize(count);
+        memcpy(&words[0], pat.begin(), pat.size());
+        naive_matches(expected, buf, pat.begin(), nullptr, pat.size(), sizeof(T));
+
+        pattern_search_t search;
+        all_matches(found, buf, sizeof(T), [&](const uchar *pSrc, ssize_t iSrcLen)
+        {
+            return search.search(pSrc, iSrcLen, &words[0], count);
+        });
+        bad += !report("pattern_search_t wide", r, pat.size(), found, expected);
+
+        compiled_pattern_t compiled;
+        compiled.compile(&words[0], count, sizeof(T));
+        all_matches(found, buf, sizeof(T), [&](const uchar *pSrc, ssize_t iSrcLen)
+        {
+            return compiled.search(pSrc, iSrcLen);
+        });
+        bad += !report("compiled_pattern_t wide", r, pat.size(), found, expected);
+    }
+    return bad;
+}
+
+// a mask byte of 0xFF mostly, else a wildcard byte or nibble
+static void make_mask(qvector<uchar> &mask, size_t iPatternLen, uint32 *state)
+{
+    static const uchar wildcards[] = { 0x00, 0xF0, 0x0F };
+    mask.resize(iPatternLen);
+    for (size_t i = 0; i < iPatternLen; i++)
+    {
+        uint32 r = bench_rand(state);
+        mask[i] = (r & 7) != 0 ? 0xFF : wildcards[(r >> 8) % qnumber(wildcards)];
+    }
+}
+
+static size_t check_masked(uint32 *state)
+{
+    qvector<uchar> buf, pat, mask;
+    std::vector<size_t> found, expected;
+    pattern_search_t search;
+    size_t bad = 0;
+    for (size_t r = 0; r < CHECK_ROUNDS; r++)
+    {
+        make_case(buf, pat, 256, 1, state);
+        make_mask(mask, pat.size(), state);
+        naive_matches(expected, buf, pat.begin(), mask.begin(), pat.size(), 1);
+        all_matches(found, buf, 1, [&](const uchar *pSrc, ssize_t iSrcLen)
+        {
+            return search.search_masked(pSrc, iSrcLen, pat.begin(), mask.begin(), pat.size());
+        });
+        bad += !report("search_masked", r, pat.size(), found, expected);
+    }
+    return bad;
+}
+
+struct collect_visitor_t : public stream_visitor_t
+{
+    std::vector<size_t> offsets;
+
+    virtual bool visit(uint64 iOffset) override
+    {
+        offsets.push_back((size_t) iOffset);
+        return true;
+    }
+};
+
+// exact and masked patterns up to LONG_PATTERN_MIN + 256 bytes, and wide
+// ones from a random origin, fed in chunks from 0 to twice the pattern length
+static size_t check_stream(uint32 *state)
+{
+    static const size_t elsizes[] = { 2, 4, 8 };
+    qvector<uchar> buf, pat, mask;
+    std::vector<size_t> expected;
+    size_t bad = 0;
+    for (size_t r = 0; r < CHECK_ROUNDS; r++)
+    {
+        const bool bMasked = 1 == (r & 3);
+        const size_t iElemSize = 2 == (r & 3) ? elsizes[bench_rand(state) % qnumber(elsizes)] : 1;
+        const uint64 iOrigin = bench_rand(state);
+        make_case(buf, pat, (r & 7) == 0 ? LONG_PATTERN_MIN + 256 : 64, iElemSize, state);
+        if (bMasked)
+        {
+            make_mask(mask, pat.size(), state);
+        }
+
+        // the wide matches at the offsets aligned from the origin
+        const size_t iFirst = (iElemSize - iOrigin % iElemSize) % iElemSize;
+        naive_matches(expected, buf, pat.begin(), bMasked ? mask.begin() : nullptr, pat.size(), 1);
+        size_t n = 0;
+        for (size_t i = 0; i < expected.size(); i++)
+        {
+            if (expected[i] % iElemSize == iFirst)
+            {
+                expected[n++] = expected[i];
+            }
+        }
+        expected.resize(n);
+
+        stream_search_t stream;
+        collect_visitor_t visitor;
+        stream.start(pat.begin(), bMasked ? mask.begin() : nullptr, pat.size(), iElemSize);
+        stream.reset(iOrigin);
+        for (size_t off = 0; off < buf.size(); )
+        {
+            size_t n = qmin((size_t) (bench_rand(state) % (2 * pat.size() + 1)), buf.size() - off);
+            stream.feed(buf.begin() + off, n, visitor);
+            off += n;
+        }
+        bad += !report(bMasked ? "stream_search_t masked" : 1 != iElemSize ? "stream_search_t wide" : "stream_search_t",
+                       r, pat.size(), visitor.offsets, expected);
+    }
+    return bad;
+}
+
+static size_t run_checks()
+{
+    uint32 state = 0x9E3779B9;
+    size_t bad = 0;
+    bad += check_wide<uint16>(&state);
+    bad += check_wide<uint32>(&state);
+    bad += check_wide<uint64>(&state);
+    bad += check_masked(&state);
+    bad += check_stream(&state);
+    printf("cross checks: %d mismatches\n", (int) bad);
+    return bad;
+}
+
+//--------------------------------------------------------------------------
+int main(int argc, char *argv[])
+{
+    size_t size = (size_t) BENCH_SIZE_MB << 20;
+    std::vector<const char *> files;
+    for (int i = 1; i < argc; i++)
+    {
+        if (0 == strcmp(argv[i], "-s") && i + 1 < argc)
+        {
+            size = (size_t) atoi(argv[++i]) << 20;
+        }
+        else if (0 == strcmp(argv[i], "-c"))
+        {
+            return 0 == run_checks() ? 0 : 1;
+        }
+        else
+        {
+            files.push_back(argv[i]);
+        }
+    }
+
+    uint32 state = 0x12345678;
+    buffer_t b;
+    make_low_entropy(b, size, &state);
+    run_buffer(b, &state);
+    make_text(b, size, &state);
+    run_buffer(b, &state);
+    make_skewed(b, size, &state);
+    run_buffer(b, &state);
+    make_random(b, size, &state);
+    run_buffer(b, &state);
+
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        if (!read_file(b, files[i]))
+        {
+            fprintf(stderr, "%s: cannot read\n", files[i]);
+            continue;
+        }
+        run_buffer(b, &state);
+    }
+
+    return 0;
+}
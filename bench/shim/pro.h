@@ -0,0 +1,54 @@
+// Stand-in for the pro.h of the IDA SDK, for the benchmark only: the types
+// and the qvector used by hal_search.cpp
+
+#ifndef _BENCH_PRO_H_
+#define _BENCH_PRO_H_
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#ifdef _MSC_VER
+typedef ptrdiff_t ssize_t;
+#else
+#include <sys/types.h>
+#endif
+
+typedef unsigned char   uchar;
+typedef uint16_t        uint16;
+typedef uint32_t        uint32;
+typedef uint64_t        uint64;
+typedef int32_t         int32;
+
+#define qnumber(x)      (sizeof(x) / sizeof((x)[0]))
+#define DECLARE_TYPE_AS_MOVABLE(T) struct dummy_movable_##T
+
+template <class T> inline T qmin(const T &a, const T &b) { return a < b ? a : b; }
+template <class T> inline T qmax(const T &a, const T &b) { return a < b ? b : a; }
+template <class T> inline void qswap(T &a, T &b) { T t = a; a = b; b = t; }
+
+// begin() and end() are pointers, push_back() without argument appends a
+// default element and returns it
+template <class T>
+class qvector : public std::vector<T>
+{
+    typedef std::vector<T> base_t;
+public:
+    typedef T *iterator;
+    typedef const T *const_iterator;
+
+    T *begin() { return base_t::data(); }
+    T *end() { return base_t::data() + base_t::size(); }
+    const T *begin() const { return base_t::data(); }
+    const T *end() const { return base_t::data() + base_t::size(); }
+
+    T &push_back() { base_t::emplace_back(); return base_t::back(); }
+    void push_back(const T &x) { base_t::push_back(x); }
+    bool has(const T &x) const { return std::find(base_t::begin(), base_t::end(), x) != base_t::end(); }
+};
+
+#endif  // _BENCH_PRO_H_
@@ -0,0 +1,12 @@
+// Stand-in for windows.h, for the benchmark only: the types used by
+// hal_search.cpp
+
+#ifndef _BENCH_WINDOWS_H_
+#define _BENCH_WINDOWS_H_
+
+#pragma once
+
+typedef unsigned char BYTE;
+typedef BYTE *PBYTE;
+
+#endif  // _BENCH_WINDOWS_H_
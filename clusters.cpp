@@ -0,0 +1,243 @@
+// Algorithm instances
+//
+// One implementation of an algorithm gives many matches: the eight S-boxes
+// of DES, Te0..Te3 and rcon of AES, its operand constants... The matches of
+// the same algorithm are grouped by address: each one covers an interval
+// (the array, the sparse elements, the instructions), the intervals sorted
+// by start are merged while the gap to the next one is at most
+// CLUSTER_MAX_GAP. Each group is one instance of the algorithm, with a
+// confidence from the share of the known signatures of the algorithm found
+// in it.
+
+#include <algorithm>
+
+#include <pro.h>
+
+#include "findcrypt3.hpp"
+
+#define CLUSTER_MAX_GAP     0x2000      // max bytes between two matches of an instance
+#define CLUSTER_FULL_SIGS   4           // signatures for a full confidence
+
+//--------------------------------------------------------------------------
+// interval covered by a match
+static void get_match_extent(const match_t &m, ea_t *start, ea_t *end)
+{
+    const array_info_t *ai = m.ai;
+    asize_t size;
+    switch (m.type)
+    {
+        case MATCH_ARRAY:
+            size = ai->size * ai->elsize;
+            break;
+        case MATCH_OPCODE:
+            size = ai->size;
+            break;
+        case MATCH_SPARSE:
+        case MATCH_POOL:
+            size = ai->elsize;
+            break;
+        default:
+            size = 1;
+            break;
+    }
+
+    *start = m.ea;
+    *end = m.ea + size;
+    for (size_t i = 0; i < m.eas.size(); ++i)
+    {
+        *start = qmin(*start, m.eas[i]);
+        *end = qmax(*end, m.eas[i] + size);
+    }
+}
+
+// tables and sequences are stronger evidence than single values
+static int get_match_weight(const match_t &m)
+{
+    switch (m.type)
+    {
+        case MATCH_ARRAY:
+        case MATCH_SPARSE:
+        case MATCH_OPCODE:
+            return 2;
+    }
+    return 1;
+}
+
+//--------------------------------------------------------------------------
+struct extent_t
+{
+    ea_t start;
+    ea_t end;
+    size_t match;
+};
+DECLARE_TYPE_AS_MOVABLE(extent_t);
+
+static const char *get_algorithm(const matchvec_t &matches, const extent_t &e)
+{
+    return matches[e.match].ai->algorithm;
+}
+
+//--------------------------------------------------------------------------
+// number of signatures of each algorithm in all the tables
+struct alg_count_t
+{
+    const char *algorithm;
+    int count;
+};
+DECLARE_TYPE_AS_MOVABLE(alg_count_t);
+
+static bool alg_count_less(const alg_count_t &a, const alg_count_t &b)
+{
+    return strcmp(a.algorithm, b.algorithm) < 0;
+}
+
+static void count_signatures(qvector<alg_count_t> &counts)
+{
+    qvector<const char *> names;
+    const array_info_t *tables[] = { non_sparse_consts, sparse_consts, operand_consts };
+    for (size_t t = 0; t < qnumber(tables); ++t)
+    {
+        for (const array_info_t *ptr = tables[t]; ptr->size != 0; ++ptr)
+        {
+            names.push_back(ptr->algorithm);
+        }
+    }
+    for (const opcode_info_t *ptr = opcode_consts; ptr->ai.size != 0; ++ptr)
+    {
+        names.push_back(ptr->ai.algorithm);
+    }
+
+    counts.clear();
+    for (size_t i = 0; i < names.size(); ++i)
+    {
+        alg_count_t &c = counts.push_back();
+        c.algorithm = names[i];
+        c.count = 1;
+    }
+    std::sort(counts.begin(), counts.end(), alg_count_less);
+
+    size_t n = 0;
+    for (size_t i = 0; i < counts.size(); ++i)
+    {
+        if (n > 0 && streq(counts[n - 1].algorithm, counts[i].algorithm))
+        {
+            counts[n - 1].count++;
+        }
+        else
+        {
+            counts[n++] = counts[i];
+        }
+    }
+    counts.resize(n);
+}
+
+static int get_expected_signatures(const qvector<alg_count_t> &counts, const char *algorithm)
+{
+    alg_count_t key;
+    key.algorithm = algorithm;
+    key.count = 0;
+    const alg_count_t *p = std::lower_bound(counts.begin(), counts.end(), key, alg_count_less);
+    return (p != counts.end() && streq(p->algorithm, algorithm)) ? p->count : 1;
+}
+
+//--------------------------------------------------------------------------
+// the confidence of an instance: the distinct signatures found, tables
+// counted twice, against min(expected, CLUSTER_FULL_SIGS) tables
+static void score_instance(const matchvec_t &matches, const qvector<alg_count_t> &counts,
+                           const size_t *idx, instance_t &inst)
+{
+    qvector<const array_info_t *> seen;
+    int points = 0;
+    for (size_t i = 0; i < inst.nmatches; ++i)
+    {
+        const match_t &m = matches[idx[inst.first + i]];
+        if (seen.has(m.ai))
+        {
+            continue;
+        }
+        seen.push_back(m.ai);
+        points += get_match_weight(m);
+    }
+
+    inst.nsigs = (int) seen.size();
+    inst.expected = get_expected_signatures(counts, inst.algorithm);
+    int full = 2 * qmin(inst.expected, CLUSTER_FULL_SIGS);
+    inst.confidence = qmin(100, points * 100 / full);
+}
+
+//--------------------------------------------------------------------------
+// group the matches into algorithm instances, sorted by address
+// order receives the match indexes of the instances: the matches of
+// instances[i] are matches[order[first]] .. matches[order[first + nmatches - 1]]
+struct extent_less_t
+{
+    const matchvec_t &matches;
+    extent_less_t(const matchvec_t &m) : matches(m) {}
+
+    bool operator()(const extent_t &a, const extent_t &b) const
+    {
+        int cmp = strcmp(get_algorithm(matches, a), get_algorithm(matches, b));
+        if (0 != cmp)
+        {
+            return cmp < 0;
+        }
+        return a.start != b.start ? a.start < b.start : a.match < b.match;
+    }
+};
+
+static bool instance_less(const instance_t &a, const instance_t &b)
+{
+    return a.start != b.start ? a.start < b.start : strcmp(a.algorithm, b.algorithm) < 0;
+}
+
+void cluster_matches(const matchvec_t &matches, qvector<instance_t> &instances, qvector<size_t> &order)
+{
+    instances.clear();
+    order.clear();
+    if (matches.empty())
+    {
+        return;
+    }
+
+    qvector<extent_t> extents;
+    extents.resize(matches.size());
+    for (size_t i = 0; i < matches.size(); ++i)
+    {
+        get_match_extent(matches[i], &extents[i].start, &extents[i].end);
+        extents[i].match = i;
+    }
+    std::sort(extents.begin(), extents.end(), extent_less_t(matches));
+
+    qvector<alg_count_t> counts;
+    count_signatures(counts);
+
+    order.resize(extents.size());
+    for (size_t i = 0; i < extents.size(); ++i)
+    {
+        order[i] = extents[i].match;
+
+        const char *algorithm = get_algorithm(matches, extents[i]);
+        instance_t *inst = instances.empty() ? nullptr : &instances.back();
+        if (nullptr == inst
+         || !streq(inst->algorithm, algorithm)
+         || extents[i].start > inst->end + CLUSTER_MAX_GAP)
+        {
+            inst = &instances.push_back();
+            inst->algorithm = algorithm;
+            inst->start = extents[i].start;
+            inst->end = extents[i].end;
+            inst->first = i;
+            inst->nmatches = 0;
+        }
+
+        inst->end = qmax(inst->end, extents[i].end);
+        inst->nmatches++;
+    }
+
+    for (size_t i = 0; i < instances.size(); ++i)
+    {
+        score_instance(matches, counts, order.begin(), instances[i]);
+    }
+
+    std::sort(instances.begin(), instances.end(), instance_less);
+}
@@ -66,6 +66,67 @@ static const word32 zdeflate_configurationTable[4 * 10] =
     /* 9 */ 32,  258, 258, 4096,    /* maximum compression */
 };
 
+// deflate.c: the configuration_table of zlib, four ush and the pointer of
+// the compress function per entry, 32 and 64-bit layouts. The relocated
+// pointers are wildcards in the masks
+static const word16 zlib_deflate_config32[6 * 10] =
+{
+    /*      good lazy nice chain func */
+    /* 0 */  0,    0,   0,    0,  0, 0, /* store only */
+    /* 1 */  4,    4,   8,    4,  0, 0, /* max speed, no lazy matches */
+    /* 2 */  4,    5,  16,    8,  0, 0,
+    /* 3 */  4,    6,  32,   32,  0, 0,
+    /* 4 */  4,    4,  16,   16,  0, 0, /* lazy matches */
+    /* 5 */  8,   16,  32,   32,  0, 0,
+    /* 6 */  8,   16, 128,  128,  0, 0,
+    /* 7 */  8,   32, 128,  256,  0, 0,
+    /* 8 */ 32,  128, 258, 1024,  0, 0,
+    /* 9 */ 32,  258, 258, 4096,  0, 0, /* max compression */
+};
+
+static const word16 zlib_deflate_config32_mask[6 * 10] =
+{
+    0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0, 0,
+    0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0, 0,
+    0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0, 0,
+    0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0, 0,
+    0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0, 0,
+    0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0, 0,
+    0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0, 0,
+    0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0, 0,
+    0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0, 0,
+    0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0, 0,
+};
+
+static const word16 zlib_deflate_config64[8 * 10] =
+{
+    /*      good lazy nice chain func */
+    /* 0 */  0,    0,   0,    0,  0, 0, 0, 0,   /* store only */
+    /* 1 */  4,    4,   8,    4,  0, 0, 0, 0,   /* max speed, no lazy matches */
+    /* 2 */  4,    5,  16,    8,  0, 0, 0, 0,
+    /* 3 */  4,    6,  32,   32,  0, 0, 0, 0,
+    /* 4 */  4,    4,  16,   16,  0, 0, 0, 0,   /* lazy matches */
+    /* 5 */  8,   16,  32,   32,  0, 0, 0, 0,
+    /* 6 */  8,   16, 128,  128,  0, 0, 0, 0,
+    /* 7 */  8,   32, 128,  256,  0, 0, 0, 0,
+    /* 8 */ 32,  128, 258, 1024,  0, 0, 0, 0,
+    /* 9 */ 32,  258, 258, 4096,  0, 0, 0, 0,   /* max compression */
+};
+
+static const word16 zlib_deflate_config64_mask[8 * 10] =
+{
+    0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0, 0, 0, 0,
+    0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0, 0, 0, 0,
+    0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0, 0, 0, 0,
+    0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0, 0, 0, 0,
+    0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0, 0, 0, 0,
+    0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0, 0, 0, 0,
+    0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0, 0, 0, 0,
+    0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0, 0, 0, 0,
+    0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0, 0, 0, 0,
+    0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0, 0, 0, 0,
+};
+
 static const word16 zdeflate_border[] =
 {
     // Order of the bit length code lengths
@@ -18990,6 +19051,8 @@ const array_info_t non_sparse_consts[] =
     { ARR_LE(zlib_trees_extra_dbits),           "zlib"                          },
     { ARR_LE(zdeflate_lengthCodes),             "zlib"                          },
     { ARR_LE(zdeflate_configurationTable),      "zlib"                          },
+    { ARR_LE(zlib_deflate_config32),            "zlib", zlib_deflate_config32_mask },
+    { ARR_LE(zlib_deflate_config64),            "zlib", zlib_deflate_config64_mask },
     { ARR_LE(zdeflate_border),                  "zlib"                          },
     { ARR_LE(zlib_dist_code),                   "zlib"                          },
     { ARR_LE(zlib_length_code),                 "zlib"                          },
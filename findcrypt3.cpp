@@ -10,6 +10,7 @@
 // Version 3 - add some constants by HTC (TQN)
 
 #include <set>
+#include <algorithm>
 
 #include <pro.h>
 #include <ida.hpp>
@@ -18,13 +19,39 @@
 #include <loader.hpp>
 #include <kernwin.hpp>
 #include <bytes.hpp>
+#include <funcs.hpp>
 #include <name.hpp>
 #include <moves.hpp>
+#include <segment.hpp>
+#include <xref.hpp>
 
 #include "findcrypt3.hpp"
+#include "hal_search.hpp"
 
 #define VERIFY_CONSTANTS    1   // Turn on to test the duplicate of constants for the first build and test
-#define PLUGIN_NAME         "FindCrypt3"
+//#define REPORT_EACH_MATCH   1   // Turn on to print every match, not only the algorithm instances
+#define SPARSE_WINDOW(n)    (64 * (n) + 4)  // bytes after the first constant of a sparse array holding the others
+#define SCAN_CHUNK_SIZE     0x100000    // the database is read in chunks of 1MB
+#define ARRAY_ENGINE        0           // table pass: 0 byte scan, 1 Wu-Manber, 2 IDA bin_search, see SCAN_BENCHMARK
+#define BINPAT_BATCH        32          // tables per bin_search
+
+// argument of run(), set in plugins.cfg
+#define SCAN_FULL           0           // all the engines on the range
+#define SCAN_XREF_TRIAGE    1           // the tables around the data xref targets only
+#define SCAN_TIME_TRIAGE    2           // the cheap engines by priority under a time budget
+#define SCAN_BENCHMARK      3           // time the table engines, nothing is annotated
+#define SCAN_MODE_MASK      0xFF
+#define SCAN_SKIP_LIBRARIES 0x100       // flag: the regions of the CRT, libgcc2 and zlib tables
+                                        // are skipped after the table pass
+#define SCAN_BUDGET_SHIFT   16          // SCAN_TIME_TRIAGE: bits 16..23, time budget in 100 ms
+#define SCAN_HITS_SHIFT     24          // SCAN_TIME_TRIAGE: bits 24..31, confirmed families to stop
+#define TRIAGE_BUDGET_MS    1000        // default time budget
+#define TRIAGE_MAX_HITS     8           // default confirmed families to stop
+#define TRIAGE_CONFIRMED    50          // confidence of a confirmed family
+#define TRIAGE_STEP         0x10000     // bytes scanned between two checks of the budget
+#define INSTANCE_MAX_NAMES  8           // signature names listed per algorithm instance
+#define RANK_MIN_SCORE      50          // crypto-likelihood of the reported functions
+#define RANK_MAX_FUNCS      50          // length of the ranked list
 
 //--------------------------------------------------------------------------
 // retrieve the first byte of the specified array
@@ -87,6 +114,28 @@ static int verify_constants(const array_info_t *consts)
     return ret;
 }
 
+// every opcode signature must compile into the masked matcher, a signature
+// without an anchor is skipped by the scan
+static int verify_opcode_constants(const opcode_info_t *consts)
+{
+    int ret = 0;
+    for (const opcode_info_t *ptr = consts; ptr->ai.size != 0; ++ptr)
+    {
+        masked_matcher_t matcher;
+        masked_pattern_t pat;
+        pat.bytes.resize(ptr->ai.size);
+        pat.mask.resize(ptr->ai.size);
+        memcpy(pat.bytes.begin(), ptr->ai.array, ptr->ai.size);
+        memcpy(pat.mask.begin(), ptr->mask, ptr->ai.size);
+        if (matcher.add_pattern(pat) < 0)
+        {
+            msg("[%s] - opcode signature %s has no anchor!\n", PLUGIN_NAME, ptr->ai.name);
+            ret = -1;
+        }
+    }
+    return ret;
+}
+
 #endif
 
 //--------------------------------------------------------------------------
@@ -140,81 +189,6 @@ static bool match_array_pattern(ea_t ea, const array_info_t *ai)
     return true;
 }
 
-//--------------------------------------------------------------------------
-// match a sparse array against the database at the specified address
-// NB: all sparse arrays must be word32!
-static bool match_sparse_pattern(ea_t ea, const array_info_t *ai, eavec_t &eaFounds)
-{
-    assert(nullptr != ai);
-    assert(nullptr != ai->array);
-    if (nullptr == ai || nullptr == ai->array)
-    {
-        msg("[%s] - " __FUNCTION__ ": Invalid input parameters: %s\n",
-            PLUGIN_NAME, (nullptr != ai) ? ai->name : "ai is nullptr");
-        return false;
-    }
-
-    const word32 *ptr = (const word32*) ai->array;
-
-    eaFounds.clear();
-
-    // Optimize for size is 1
-    if (get_dword(ea) != *ptr)
-    {
-        return false;
-    }
-
-    eaFounds.push_back(ea);
-    if (1 == ai->size)
-    {
-        return true;
-    }
-
-    // Scan next ea
-    ea += 4;
-
-    // look for the constant in the next 64 x ai->size bytes
-    size_t sizeN = (64 * ai->size) + 4;
-
-    qvector<byte> mem;
-    mem.resize(sizeN);
-
-    ssize_t sizeRead = get_bytes(mem.begin(), sizeN, ea, GMB_READALL);
-    if (sizeRead <= 0)
-    {
-        // msg("[%s] - " __FUNCTION__ ": get_bytes at %a failed\n", PLUGIN_NAME, ea);
-        return false;
-    }
-
-    for (size_t i = 1; i < ai->size; ++i)
-    {
-        word32 c = ptr[i];
-        if (inf.is_be())
-        {
-            c = swap32(c);
-        }
-
-        ssize_t j = 0;
-        for (j = 0; j < sizeRead; j++)
-        {
-            if (c == *(word32 *)(mem.begin() + j))
-            {
-                const ea_t ea_found = ea + j;
-                // msg("DEBUG - 0x%a - 0x%x\n", ea_found, c);
-                eaFounds.push_back(ea_found);
-                break;
-            }
-        }
-
-        if (j == sizeRead)
-        {
-            return false;
-        }
-    }
-
-    return eaFounds.size() > 0;
-}
-
 //--------------------------------------------------------------------------
 // Set or append comment at the address ea
 //
@@ -330,91 +304,1765 @@ static bool make_array(ea_t ea, const array_info_t *ptr)
 }
 
 //--------------------------------------------------------------------------
-// try to find constants at the given address range
-static void recognize_constants(ea_t ea1, ea_t ea2)
+// element i of a sparse array as stored in the database
+static void make_sparse_element(const variant_t &var, size_t i, uchar *bytes)
 {
-    int count = 0;
+    const size_t elsize = var.ai->elsize;
+    for (size_t j = 0; j < elsize; ++j)
+    {
+        uchar b = (uchar) (var.values[i] >> (j * 8));
+        bytes[inf.is_be() ? elsize - 1 - j : j] = b;
+    }
+}
 
-    msg_clear();
-    show_wait_box("Searching for crypto constants in range 0x%a - 0x%a...", ea1, ea2);
+// build a gapped pattern of a sparse array. ordered: all its elements in
+// order, each one after the end of the previous one and all within the
+// bytes of the unordered search. Else its first element only, the others
+// are verified by sparse_visitor_t in any order
+static void make_sparse_pattern(const variant_t &var, bool ordered, gapped_pattern_t &pat)
+{
+    const size_t elsize = var.ai->elsize;
+    const size_t count = ordered ? var.values.size() : 1;
+    pat.slices.clear();
+    pat.max_span = ordered ? 2 * elsize + SPARSE_WINDOW(var.values.size()) - 1 : 0;
+    pat.ud = &var;
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        gap_slice_t &slice = pat.slices.push_back();
+        slice.bytes.resize(elsize);
+        make_sparse_element(var, i, slice.bytes.begin());
+        slice.min_gap = 0;
+        slice.max_gap = ordered ? GAP_UNLIMITED : 0;
+    }
+}
+
+// bytes from the first element of a sparse array to the end of the last
+// one it may use
+static asize_t get_sparse_span()
+{
+    asize_t span = 0;
+    for (const array_info_t *ptr = sparse_consts; ptr->size != 0; ++ptr)
+    {
+        span = qmax(span, (asize_t) (2 * ptr->elsize + SPARSE_WINDOW(ptr->size)));
+    }
+    return span;
+}
+
+static bool match_less(const match_t &a, const match_t &b)
+{
+    if (a.ea != b.ea)
+    {
+        return a.ea < b.ea;
+    }
+    return a.ai != b.ai ? a.ai < b.ai : a.variant < b.variant;
+}
 
-    for (ea_t ea = ea1; ea < ea2; ea = next_addr(ea))
+// collect the matches which start in the first 'limit' bytes of the chunk,
+// the others will be found again in the next chunk. The arrays stored in
+// order are matched by their ordered pattern in the scan. The compilers do
+// not always store the constants in order: after the scan, at each first
+// element without an ordered match, every other element is searched in the
+// SPARSE_WINDOW bytes after it, in any order
+struct sparse_visitor_t : public gapped_visitor_t
+{
+    struct candidate_t
+    {
+        const variant_t *var;
+        size_t offset;
+    };
+
+    ea_t base;
+    size_t limit;
+    const uchar *buf;           // the chunk
+    size_t size;
+    matchvec_t matches;
+    qvector<candidate_t> candidates;    // first elements of the chunk
+    size_t chunk_first;                 // first match of the chunk
+    pattern_search_t search;            // the other elements in the window
+
+    sparse_visitor_t() : base(0), limit(0), buf(nullptr), size(0), chunk_first(0) {}
+
+    virtual bool visit(size_t, const gapped_pattern_t &pat, const size_t *offsets)
     {
-        if (0 == (ea % 0x1000))
+        if (offsets[0] >= limit)
         {
-            show_addr(ea);
-            if (user_cancelled())
+            return true;
+        }
+
+        const variant_t *var = (const variant_t *) pat.ud;
+        if (1 == pat.slices.size() && var->values.size() > 1)
+        {
+            candidate_t c = { var, offsets[0] };
+            candidates.push_back(c);
+            return true;
+        }
+
+        eavec_t eas;
+        for (size_t i = 0; i < pat.slices.size(); ++i)
+        {
+            eas.push_back(base + offsets[i]);
+        }
+        add_match(var, eas);
+        return true;
+    }
+
+    // the unordered search at the first elements of the chunk
+    void verify_candidates()
+    {
+        for (size_t c = 0; c < candidates.size(); ++c)
+        {
+            const variant_t *var = candidates[c].var;
+            const size_t first = candidates[c].offset;
+            if (has_match(var, base + first))
             {
-                break;
+                continue;
+            }
+
+            const size_t elsize = var->ai->elsize;
+            const size_t start = first + elsize;
+            const size_t end = qmin(size, start + SPARSE_WINDOW(var->values.size()) - 1 + elsize);
+
+            eavec_t eas;
+            eas.push_back(base + first);
+            uchar bytes[sizeof(uint64)];
+            size_t i;
+            for (i = 1; i < var->values.size(); ++i)
+            {
+                make_sparse_element(*var, i, bytes);
+                const ssize_t j = search.search(buf + start, end - start, bytes, elsize, 0);
+                if (j < 0)
+                {
+                    break;
+                }
+                eas.push_back(base + start + j);
+            }
+
+            if (i == var->values.size())
+            {
+                add_match(var, eas);
             }
         }
 
-        uchar b = get_byte(ea);
+        candidates.clear();
+        chunk_first = matches.size();
+    }
 
-        // check against normal constants
-        for (const array_info_t *ptr = non_sparse_consts; ptr->size != 0; ++ptr)
+private:
+    bool has_match(const variant_t *var, ea_t ea) const
+    {
+        for (size_t i = chunk_first; i < matches.size(); ++i)
         {
-            if (b != get_first_byte(ptr))
+            if (matches[i].ea == ea && matches[i].ai == var->ai && matches[i].variant == var->type)
             {
-                continue;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void add_match(const variant_t *var, eavec_t &eas)
+    {
+        match_t &m = matches.push_back();
+        m.ea = eas[0];
+        m.ai = var->ai;
+        m.type = MATCH_SPARSE;
+        m.variant = var->type;
+        m.eas.swap(eas);
+    }
+};
+
+// same for the opcode signatures
+struct opcode_visitor_t : public masked_visitor_t
+{
+    ea_t base;
+    size_t limit;
+    matchvec_t matches;
+
+    virtual bool visit(size_t, const masked_pattern_t &pat, size_t offset)
+    {
+        if (offset >= limit)
+        {
+            return true;
+        }
+
+        const opcode_info_t *oi = (const opcode_info_t *) pat.ud;
+        match_t &m = matches.push_back();
+        m.ea = base + offset;
+        m.ai = &oi->ai;
+        m.type = MATCH_OPCODE;
+        m.eas.push_back(m.ea);
+        return true;
+    }
+};
+
+//--------------------------------------------------------------------------
+// name of the matched constant, with the transform of its variant
+static void get_match_name(qstring *out, const match_t &m)
+{
+    *out = m.ai->name;
+    if (VAR_NONE != m.variant)
+    {
+        out->cat_sprnt(" (%s)", variant_name(m.variant));
+    }
+}
+
+//--------------------------------------------------------------------------
+// annotate the database with a match, the matches are kept for the report
+// of the algorithm instances
+static matchvec_t found_matches;
+
+static void report_match(const match_t &m)
+{
+    const array_info_t *ptr = m.ai;
+    qstring name, line;
+    get_match_name(&name, m);
+
+    switch (m.type)
+    {
+        case MATCH_ARRAY:
+            line.sprnt("[%s] - 0x%a: found const array %s (used in %s), size = %d, elsize = %d\n",
+                PLUGIN_NAME, m.ea, ptr->name, ptr->algorithm, ptr->size, ptr->elsize);
+            make_array(m.ea, ptr);
+            force_name(m.ea, ptr->name);
+            force_comment(m.ea, ptr->name);
+            break;
+
+        case MATCH_SPARSE:
+            line.sprnt("[%s] - 0x%a: found sparse constants %s for %s\n",
+                PLUGIN_NAME, m.ea, name.c_str(), ptr->algorithm);
+            for (eavec_t::const_iterator it = m.eas.begin(); it < m.eas.end(); ++it)
+            {
+                force_comment(*it, name.c_str());
             }
+            break;
 
-            if (match_array_pattern(ea, ptr))
+        case MATCH_SPLIT_IMM:
+            line.sprnt("[%s] - 0x%a: found 64-bit constant %s for %s as 32-bit immediates at 0x%a and 0x%a\n",
+                PLUGIN_NAME, m.ea, name.c_str(), ptr->algorithm, m.eas[0], m.eas[1]);
+            for (eavec_t::const_iterator it = m.eas.begin(); it < m.eas.end(); ++it)
             {
-                msg("[%s] - 0x%a: found const array %s (used in %s), size = %d, elsize = %d\n",
-                    PLUGIN_NAME, ea, ptr->name, ptr->algorithm, ptr->size, ptr->elsize);
-                mark_location(ea, ptr->algorithm);
-                make_array(ea, ptr);
-                force_name(ea, ptr->name);
-                force_comment(ea, ptr->name);
-                count++;
-                break;
+                force_comment(*it, name.c_str());
             }
+            break;
+
+        case MATCH_OPERAND:
+            line.sprnt("[%s] - 0x%a: found operand constant %s for %s in operand %d\n",
+                PLUGIN_NAME, m.ea, name.c_str(), ptr->algorithm, m.n + 1);
+            force_comment(m.ea, name.c_str());
+            break;
+
+        case MATCH_OPCODE:
+            line.sprnt("[%s] - 0x%a: found opcode signature %s for %s, size = %d\n",
+                PLUGIN_NAME, m.ea, ptr->name, ptr->algorithm, ptr->size);
+            force_comment(m.ea, ptr->name);
+            break;
+
+        case MATCH_POOL:
+        {
+            segment_t *seg = getseg(m.ea);
+            line.sprnt("[%s] - 0x%a: found %s constant %s for %s\n", PLUGIN_NAME, m.ea,
+                (nullptr != seg && SEG_CODE == seg->type) ? "literal pool" : "data",
+                name.c_str(), ptr->algorithm);
+            force_comment(m.ea, name.c_str());
+            break;
+        }
+
+        default:
+            assert(false);
+            return;
+    }
+
+#ifdef REPORT_EACH_MATCH
+    msg("%s", line.c_str());
+#endif
+    found_matches.push_back(m);
+}
+
+//--------------------------------------------------------------------------
+// the algorithms confirmed by the time-budgeted triage, their signatures are
+// not searched again
+static qvector<const char *> confirmed_families;
+
+static bool is_family_confirmed(const char *algorithm)
+{
+    for (size_t i = 0; i < confirmed_families.size(); ++i)
+    {
+        if (streq(confirmed_families[i], algorithm))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// add the algorithms of the instances with a confidence of at least
+// TRIAGE_CONFIRMED
+static void update_confirmed_families()
+{
+    qvector<instance_t> instances;
+    qvector<size_t> order;
+    cluster_matches(found_matches, instances, order);
+
+    for (size_t i = 0; i < instances.size(); ++i)
+    {
+        const instance_t &inst = instances[i];
+        if (inst.confidence >= TRIAGE_CONFIRMED && !is_family_confirmed(inst.algorithm))
+        {
+            confirmed_families.push_back(inst.algorithm);
         }
+    }
+}
+
+//--------------------------------------------------------------------------
+// one line and one bookmark per algorithm instance
+static int report_instances()
+{
+    qvector<instance_t> instances;
+    qvector<size_t> order;
+    cluster_matches(found_matches, instances, order);
 
-        // check against sparse constants
-        eavec_t eaFounds;
-        for (const array_info_t *ptr = sparse_consts; ptr->size != 0; ++ptr)
+    for (size_t i = 0; i < instances.size(); ++i)
+    {
+        const instance_t &inst = instances[i];
+
+        // the names of the distinct signatures, in address order
+        qvector<const array_info_t *> seen;
+        qstring names;
+        for (size_t j = 0; j < inst.nmatches; ++j)
         {
-            if (b != get_first_byte(ptr))
+            const match_t &m = found_matches[order[inst.first + j]];
+            if (seen.has(m.ai))
             {
                 continue;
             }
+            seen.push_back(m.ai);
 
-            if (match_sparse_pattern(ea, ptr, eaFounds))
+            if (seen.size() > INSTANCE_MAX_NAMES)
             {
-                msg("[%s] - 0x%a: found sparse constants %s for %s\n",
-                    PLUGIN_NAME, ea, ptr->name, ptr->algorithm);
-                mark_location(ea, ptr->algorithm);
+                names += ", ...";
+                break;
+            }
 
-                for (eavec_t::const_iterator it = eaFounds.begin(); it < eaFounds.end(); ++it)
-                {
-                    force_comment(*it, ptr->name);
-                }
-                count++;
+            qstring name;
+            get_match_name(&name, m);
+            names.cat_sprnt("%s%s", 1 == seen.size() ? "" : ", ", name.c_str());
+        }
+
+        msg("[%s] - 0x%a: %s, confidence %d%%, %d of %d signatures in %d matches up to 0x%a: %s\n",
+            PLUGIN_NAME, inst.start, inst.algorithm, inst.confidence, inst.nsigs, inst.expected,
+            (int) inst.nmatches, inst.end, names.c_str());
+
+        qstring desc;
+        desc.sprnt("%s (%d%%)", inst.algorithm, inst.confidence);
+        mark_location(inst.start, desc.c_str());
+    }
+
+    return (int) instances.size();
+}
+
+//--------------------------------------------------------------------------
+// all sparse arrays compiled into one gapped matcher, the patterns point to
+// the variants
+static bool compile_sparse_matcher(variantvec_t &variants, gapped_matcher_t &matcher)
+{
+    for (const array_info_t *ptr = sparse_consts; ptr->size != 0; ++ptr)
+    {
+        expand_variants(ptr, variants);
+    }
+
+    for (size_t i = 0; i < variants.size(); ++i)
+    {
+        gapped_pattern_t pat;
+        make_sparse_pattern(variants[i], false, pat);
+        matcher.add_pattern(pat);
+        if (variants[i].values.size() > 1)
+        {
+            make_sparse_pattern(variants[i], true, pat);
+            matcher.add_pattern(pat);
+        }
+    }
+
+    return matcher.compile();
+}
+
+// scan each range in one pass. The last tail bytes of the ranges are only
+// read for the matches starting before them
+static int scan_sparse_constants(gapped_matcher_t &matcher, const rangevec_t &ranges, asize_t tail)
+{
+    const size_t overlap = (size_t) get_sparse_span();
+
+    sparse_visitor_t visitor;
+    qvector<uchar> mem;
+    for (size_t n = 0; n < ranges.size(); ++n)
+    {
+        ea_t start = ranges[n].start_ea;
+        ea_t end = ranges[n].end_ea;
+        ea_t report_end = end - qmin(tail, ranges[n].size());
+        for (ea_t ea = start; ea < report_end; ea += SCAN_CHUNK_SIZE)
+        {
+            show_addr(ea);
+            if (user_cancelled())
+            {
                 break;
             }
+
+            size_t size = (size_t) qmin((asize_t) (end - ea), (asize_t) (SCAN_CHUNK_SIZE + overlap));
+            mem.resize(size);
+            ssize_t sizeRead = get_bytes(mem.begin(), size, ea, GMB_READALL);
+            if (sizeRead <= 0)
+            {
+                continue;
+            }
+
+            visitor.base = ea;
+            visitor.limit = (size_t) qmin((asize_t) (report_end - ea), (asize_t) SCAN_CHUNK_SIZE);
+            visitor.buf = mem.begin();
+            visitor.size = sizeRead;
+            matcher.scan(mem.begin(), sizeRead, visitor);
+            visitor.verify_candidates();
         }
     }
 
-    hide_wait_box();
-    msg("[%s] - Found %d known constant arrays in total.\n", PLUGIN_NAME, count);
+    // several arrays may share a prefix (MD5_initState and SHA1_H0),
+    // keep the first one of sparse_consts at each address
+    matchvec_t &matches = visitor.matches;
+    std::sort(matches.begin(), matches.end(), match_less);
+
+    int count = 0;
+    for (size_t i = 0; i < matches.size(); ++i)
+    {
+        if (i > 0 && matches[i - 1].ea == matches[i].ea)
+        {
+            continue;
+        }
+
+        if (is_family_confirmed(matches[i].ai->algorithm))
+        {
+            continue;
+        }
+
+        report_match(matches[i]);
+        count++;
+    }
+
+    return count;
+}
+
+// find sparse constants in the ranges
+static int recognize_sparse_constants(const rangevec_t &ranges)
+{
+    variantvec_t variants;
+    gapped_matcher_t matcher;
+    if (!compile_sparse_matcher(variants, matcher))
+    {
+        return 0;
+    }
+
+    return scan_sparse_constants(matcher, ranges, 0);
 }
 
 //--------------------------------------------------------------------------
-bool idaapi run(size_t)
+// find the opcode signatures of the current processor in the code ranges:
+// all signatures are compiled into one masked matcher
+static int recognize_opcode_constants(const rangevec_t &ranges)
 {
-    if (!auto_is_ok())
+    masked_matcher_t matcher;
+    for (const opcode_info_t *ptr = opcode_consts; ptr->ai.size != 0; ++ptr)
     {
-        warning("IDA is still analysing !\nPlugin will start after autoanalysis is finished");
-        auto_wait();
+        if (ptr->proc != PH.id)
+        {
+            continue;
+        }
+
+        masked_pattern_t pat;
+        pat.bytes.resize(ptr->ai.size);
+        pat.mask.resize(ptr->ai.size);
+        memcpy(pat.bytes.begin(), ptr->ai.array, ptr->ai.size);
+        memcpy(pat.mask.begin(), ptr->mask, ptr->ai.size);
+        pat.ud = ptr;
+        if (matcher.add_pattern(pat) < 0)
+        {
+            msg("[%s] - opcode signature %s has no anchor, skipped\n", PLUGIN_NAME, ptr->ai.name);
+        }
     }
 
-    ea_t ea1 = inf.min_ea;
-    ea_t ea2 = inf.max_ea;
+    if (0 == matcher.size() || !matcher.compile())
+    {
+        return 0;
+    }
 
-    read_range_selection(nullptr, &ea1, &ea2);     // if fails, inf.min_ea and inf.max_ea will be used
-    recognize_constants(ea1, ea2);
+    const size_t overlap = matcher.max_match_len();
+
+    opcode_visitor_t visitor;
+    qvector<uchar> mem;
+    for (size_t n = 0; n < ranges.size(); ++n)
+    {
+        ea_t start = ranges[n].start_ea;
+        ea_t end = ranges[n].end_ea;
+        for (ea_t ea = start; ea < end; ea += SCAN_CHUNK_SIZE)
+        {
+            show_addr(ea);
+            if (user_cancelled())
+            {
+                break;
+            }
+
+            size_t size = (size_t) qmin((asize_t) (end - ea), (asize_t) (SCAN_CHUNK_SIZE + overlap));
+            mem.resize(size);
+            ssize_t sizeRead = get_bytes(mem.begin(), size, ea, GMB_READALL);
+            if (sizeRead <= 0)
+            {
+                continue;
+            }
+
+            visitor.base = ea;
+            visitor.limit = SCAN_CHUNK_SIZE;
+            matcher.scan(mem.begin(), sizeRead, visitor);
+        }
+    }
+
+    matchvec_t &matches = visitor.matches;
+    std::stable_sort(matches.begin(), matches.end(), match_less);
+    for (size_t i = 0; i < matches.size(); ++i)
+    {
+        report_match(matches[i]);
+    }
+
+    return (int) matches.size();
+}
+
+//--------------------------------------------------------------------------
+// hardware crypto instructions grouped by function
+struct hw_group_hit_t
+{
+    ea_t group;                     // function start, or the hit itself outside of functions
+    hw_hit_t hit;
+};
+
+static bool is_x86_prefix(uchar b)
+{
+    switch (b)
+    {
+        case 0x26: case 0x2E: case 0x36: case 0x3E: case 0x64: case 0x65:
+        case 0x66: case 0x67: case 0xF0: case 0xF2: case 0xF3:
+            return true;
+    }
+    return PLFM_386 == PH.id && inf.is_64bit() && (b & 0xF0) == 0x40;
+}
+
+static bool hw_group_less(const hw_group_hit_t &a, const hw_group_hit_t &b)
+{
+    return a.group != b.group ? a.group < b.group : a.hit.ea < b.hit.ea;
+}
+
+static void report_hw_group(const hw_group_hit_t *first, const hw_group_hit_t *last)
+{
+    qvector<const char *> algorithms, mnems;
+    qvector<int> counts;
+    for (const hw_group_hit_t *p = first; p < last; ++p)
+    {
+        const hw_insn_t *insn = p->hit.insn;
+        if (!algorithms.has(insn->algorithm))
+        {
+            algorithms.push_back(insn->algorithm);
+        }
+
+        size_t i;
+        for (i = 0; i < mnems.size() && !streq(mnems[i], insn->mnem); ++i)
+        {
+        }
+        if (i == mnems.size())
+        {
+            mnems.push_back(insn->mnem);
+            counts.push_back(0);
+        }
+        counts[i]++;
+    }
+
+    qstring algs, insns;
+    for (size_t i = 0; i < algorithms.size(); ++i)
+    {
+        algs.cat_sprnt("%s%s", 0 == i ? "" : ", ", algorithms[i]);
+    }
+    for (size_t i = 0; i < mnems.size(); ++i)
+    {
+        insns.cat_sprnt("%s%s x%d", 0 == i ? "" : ", ", mnems[i], counts[i]);
+    }
+
+    qstring where;
+    func_t *pfn = get_func(first->group);
+    if (nullptr == pfn || get_func_name(&where, pfn->start_ea) <= 0)
+    {
+        where = "code";
+    }
+
+    msg("[%s] - 0x%a: %s uses %s instructions: %s\n",
+        PLUGIN_NAME, first->group, where.c_str(), algs.c_str(), insns.c_str());
+    mark_location(first->group, algs.c_str());
+
+    qstring cmt;
+    cmt.sprnt("%s instructions: %s", algs.c_str(), insns.c_str());
+    force_comment(first->hit.ea, cmt.c_str());
+}
+
+// find the AES-NI, SHA-NI, ARMv8 crypto... instructions of the code
+static int recognize_hw_crypto(ea_t ea1, ea_t ea2)
+{
+    hwhitvec_t hits;
+    if (!collect_hw_crypto(ea1, ea2, hits))
+    {
+        return 0;
+    }
+
+    qvector<hw_group_hit_t> groups;
+    for (size_t i = 0; i < hits.size(); ++i)
+    {
+        // the byte scan may hit the middle of an instruction or some data,
+        // only prefixes may be before the hit in an instruction
+        ea_t ea = hits[i].ea;
+        ea_t head = get_item_head(ea);
+        flags_t flags = get_flags(head);
+        if (is_code(flags))
+        {
+            ea_t prefix;
+            for (prefix = head; prefix < ea && is_x86_prefix(get_byte(prefix)); ++prefix)
+            {
+            }
+            if (prefix != ea)
+            {
+                continue;
+            }
+            ea = head;
+        }
+        else if (!is_unknown(flags))
+        {
+            continue;
+        }
+
+        func_t *pfn = get_func(ea);
+        hw_group_hit_t &g = groups.push_back();
+        g.group = (nullptr != pfn) ? pfn->start_ea : ea;
+        g.hit = hits[i];
+        g.hit.ea = ea;
+    }
+
+    std::sort(groups.begin(), groups.end(), hw_group_less);
+
+    int count = 0;
+    for (size_t i = 0; i < groups.size(); )
+    {
+        size_t j = i + 1;
+        while (j < groups.size() && groups[j].group == groups[i].group)
+        {
+            j++;
+        }
+
+        report_hw_group(groups.begin() + i, groups.begin() + j);
+        count++;
+        i = j;
+    }
+
+    return count;
+}
+
+//--------------------------------------------------------------------------
+// find operand constants in the instructions of the given address range
+static int recognize_operand_constants(ea_t ea1, ea_t ea2)
+{
+    // the tables are read by the worker threads
+    prepare_operand_tables();
+
+    // the built-in decoders are much faster than decode_insn(), on RISC
+    // processors they also find the constants split in two instructions
+    immvec_t refs;
+    bool ok;
+    if (PLFM_386 == PH.id)
+    {
+        ok = collect_x86_immediates(ea1, ea2, refs, is_operand_candidate);
+    }
+    else if (is_risc_processor())
+    {
+        ok = collect_risc_immediates(ea1, ea2, refs, is_risc_operand_candidate);
+    }
+    else
+    {
+        ok = collect_immediates(ea1, ea2, refs, is_operand_candidate);
+    }
+    if (!ok)
+    {
+        return 0;
+    }
+
+    // one decoding pass, one hash probe per operand
+    matchvec_t matches;
+    match_operand_constants(refs, matches, is_risc_processor());
+    match_split_immediates(refs, matches);
+    std::stable_sort(matches.begin(), matches.end(), match_less);
+
+    for (size_t i = 0; i < matches.size(); ++i)
+    {
+        report_match(matches[i]);
+    }
+
+    return (int) matches.size();
+}
+
+//--------------------------------------------------------------------------
+// find operand constants stored as data words, reported apart from the
+// instruction operands
+static int recognize_pool_constants(ea_t ea1, ea_t ea2)
+{
+    matchvec_t matches;
+    if (!match_pool_constants(ea1, ea2, matches))
+    {
+        return 0;
+    }
+
+    std::stable_sort(matches.begin(), matches.end(), match_less);
+    for (size_t i = 0; i < matches.size(); ++i)
+    {
+        report_match(matches[i]);
+    }
+
+    return (int) matches.size();
+}
+
+//--------------------------------------------------------------------------
+// rank the functions by the crypto-likelihood of their instruction mix,
+// for the custom and table-less ciphers. Only a list, nothing is marked.
+static void rank_crypto_functions(ea_t ea1, ea_t ea2)
+{
+    qvector<func_score_t> scores;
+    if (!score_functions(ea1, ea2, scores) || scores.empty())
+    {
+        return;
+    }
+
+    size_t n;
+    for (n = 0; n < scores.size() && n < RANK_MAX_FUNCS && scores[n].score >= RANK_MIN_SCORE; ++n)
+    {
+    }
+    if (0 == n)
+    {
+        return;
+    }
+
+    msg("[%s] - %d of %d functions look like crypto code:\n", PLUGIN_NAME, (int) n, (int) scores.size());
+    for (size_t i = 0; i < n; ++i)
+    {
+        const func_score_t &f = scores[i];
+        qstring name;
+        if (get_func_name(&name, f.start) <= 0)
+        {
+            name.sprnt("sub_%a", f.start);
+        }
+
+        msg("[%s] - 0x%a: %s crypto-likelihood %d (%u insns: xor %u, rot %u, shift %u, add %u, logic %u, calls %u, loops %u)\n",
+            PLUGIN_NAME, f.start, name.c_str(), f.score, f.insns,
+            f.xors, f.rots, f.shifts, f.adds, f.logic, f.calls, f.loops);
+    }
+}
+
+//--------------------------------------------------------------------------
+// the library regions skipped after the table pass, normalized
+static rangevec_t library_ranges;
+
+// the ranges of the plan where the engine runs, at the priority or at all
+// of them if priority < 0, without the library regions
+// returns false if there are none
+static bool get_plan_ranges(const qvector<scan_range_t> &plan, int priority, uint32 engine, rangevec_t &ranges)
+{
+    ranges.clear();
+    for (size_t i = 0; i < plan.size(); ++i)
+    {
+        const scan_range_t &r = plan[i];
+        if ((priority < 0 || r.priority == priority) && 0 != (r.engines & engine))
+        {
+            subtract_ranges(r.range.start_ea, r.range.end_ea, library_ranges, ranges);
+        }
+    }
+    return !ranges.empty();
+}
+
+// the addresses outside of the ranges, normalized
+static void complement_ranges(const rangevec_t &ranges, rangevec_t &out)
+{
+    rangevec_t sorted = ranges;
+    normalize_ranges(sorted);
+
+    out.clear();
+    ea_t prev = 0;
+    for (size_t i = 0; i < sorted.size(); ++i)
+    {
+        if (sorted[i].start_ea > prev)
+        {
+            out.push_back(range_t(prev, sorted[i].start_ea));
+        }
+        prev = sorted[i].end_ea;
+    }
+    if (prev < BADADDR)
+    {
+        out.push_back(range_t(prev, BADADDR));
+    }
+}
+
+// the engines reading snapshots of the segments only see the ranges
+static void restrict_scans(const rangevec_t &ranges)
+{
+    rangevec_t excluded;
+    complement_ranges(ranges, excluded);
+    set_excluded_ranges(excluded);
+}
+
+static void report_scan_plan(const qvector<scan_range_t> &plan, asize_t skipped)
+{
+    asize_t sizes[SEGCLASS_COUNT] = { 0 };
+    for (size_t i = 0; i < plan.size(); ++i)
+    {
+        sizes[plan[i].segclass] += plan[i].range.size();
+    }
+
+    // the classes by priority
+    qstring line;
+    for (size_t i = 0; i < plan.size(); ++i)
+    {
+        int segclass = plan[i].segclass;
+        if (0 == sizes[segclass])
+        {
+            continue;
+        }
+
+        line.cat_sprnt("%s%s 0x%a", line.empty() ? "" : ", ", get_segclass_name(segclass), sizes[segclass]);
+        sizes[segclass] = 0;
+    }
+
+    msg("[%s] - Scan plan: %s bytes, 0x%a bytes skipped\n", PLUGIN_NAME, line.c_str(), skipped);
+}
+
+// bytes of the longest table or sparse array
+static asize_t get_max_table_size()
+{
+    asize_t size = 0;
+    for (const array_info_t *ptr = non_sparse_consts; ptr->size != 0; ++ptr)
+    {
+        size = qmax(size, (asize_t) (ptr->size * ptr->elsize));
+    }
+    for (const array_info_t *ptr = sparse_consts; ptr->size != 0; ++ptr)
+    {
+        size = qmax(size, (asize_t) (2 * ptr->elsize + SPARSE_WINDOW(ptr->size)));
+    }
+    return size;
+}
+
+// the addresses from before bytes before to after bytes after the data xref
+// targets in the given ranges, merged. Returns the number of targets
+static size_t get_xref_ranges(const rangevec_t &segs, asize_t before, asize_t after, rangevec_t &ranges)
+{
+    // the targets come sorted
+    ranges.clear();
+    size_t targets = 0;
+    for (size_t n = 0; n < segs.size(); ++n)
+    {
+        const range_t &seg = segs[n];
+        for (ea_t ea = find_dref_target(seg.start_ea, seg.end_ea); ea != BADADDR; ea = find_dref_target(ea + 1, seg.end_ea))
+        {
+            targets++;
+
+            ea_t start = (ea - seg.start_ea > before) ? ea - before : seg.start_ea;
+            ea_t end = (seg.end_ea - ea > after) ? ea + after : seg.end_ea;
+            if (!ranges.empty() && ranges.back().end_ea >= start && ranges.back().start_ea <= start)
+            {
+                ranges.back().end_ea = qmax(ranges.back().end_ea, end);
+            }
+            else
+            {
+                ranges.push_back(range_t(start, end));
+            }
+        }
+    }
+
+    return targets;
+}
+
+//--------------------------------------------------------------------------
+// the tables of several KB and the masked ones are searched one by one with
+// the long and masked pattern searches of hal_search, not verified at every
+// byte nor compiled with the others
+static bool is_searched_alone(const array_info_t *ai)
+{
+    return ai->size * ai->elsize >= LONG_PATTERN_MIN || nullptr != ai->mask;
+}
+
+// the bytes of the table data or mask as stored in the database
+static void make_array_bytes(const array_info_t *ai, const void *data, qvector<uchar> &bytes)
+{
+    const uchar *src = (const uchar *) data;
+    const size_t elsize = ai->elsize;
+    bytes.resize(ai->size * elsize);
+    for (size_t i = 0; i < ai->size; ++i)
+    {
+        for (size_t j = 0; j < elsize; ++j)
+        {
+            bytes[i * elsize + j] = src[i * elsize + (inf.is_be() ? elsize - 1 - j : j)];
+        }
+    }
+}
+
+// the matches of a table searched alone, at the offsets of its stream
+struct alone_visitor_t : public stream_visitor_t
+{
+    matchvec_t &matches;
+    const array_info_t *ai;
+    ea_t base;                  // address of the stream start
+    asize_t limit;              // the matches start before base + limit
+
+    alone_visitor_t(matchvec_t &m) : matches(m), ai(nullptr), base(0), limit(0) {}
+
+    virtual bool visit(uint64 offset)
+    {
+        if (offset >= limit)
+        {
+            return false;
+        }
+
+        match_t &m = matches.push_back();
+        m.ea = base + offset;
+        m.ai = ai;
+        m.type = MATCH_ARRAY;
+        return true;
+    }
+};
+
+// the tables searched alone, each with its stream
+struct alone_set_t
+{
+    qvector<const array_info_t *> tables;
+    qvector<stream_search_t> streams;
+    size_t overlap;             // longest table
+    ea_t base;                  // address of the stream start
+    asize_t limit;              // the matches start before base + limit
+
+    alone_set_t() : overlap(0), base(0), limit(0) {}
+};
+
+// the element size of the stream of a table: the long exact tables of wide
+// elements are searched at the aligned addresses only, as the pool scan
+// does, with the longer skips of the wide search. A 32-bit program aligns
+// its 8-byte elements at 4 bytes only
+static size_t get_stream_elsize(const array_info_t *ai)
+{
+    if (nullptr != ai->mask || ai->size * ai->elsize < LONG_PATTERN_MIN)
+    {
+        return 1;
+    }
+    return (8 == ai->elsize && !inf.is_64bit()) ? 4 : ai->elsize;
+}
+
+// the streams of the long and masked tables, and of the tables shorter than
+// min_shared bytes
+static void compile_arrays_alone(alone_set_t &set, size_t min_shared)
+{
+    qvector<uchar> image;
+    qvector<uchar> mask;
+    for (const array_info_t *ptr = non_sparse_consts; ptr->size != 0; ++ptr)
+    {
+        if ((is_searched_alone(ptr) || ptr->size * ptr->elsize < min_shared) && !is_family_confirmed(ptr->algorithm))
+        {
+            make_array_bytes(ptr, ptr->array, image);
+            if (nullptr != ptr->mask)
+            {
+                make_array_bytes(ptr, ptr->mask, mask);
+            }
+            set.tables.push_back(ptr);
+            set.streams.push_back().start(image.begin(), nullptr != ptr->mask ? mask.begin() : nullptr, image.size(), get_stream_elsize(ptr));
+            set.overlap = qmax(set.overlap, image.size());
+        }
+    }
+}
+
+// new streams from start, for the matches starting before end
+static void restart_arrays_alone(alone_set_t &set, ea_t start, ea_t end)
+{
+    for (size_t t = 0; t < set.streams.size(); ++t)
+    {
+        set.streams[t].reset(start);
+    }
+    set.base = start;
+    set.limit = (end > start) ? end - start : 0;
+}
+
+// feed the bytes from ea to stop to the streams, the tables of the families
+// confirmed since the compilation are skipped
+static void feed_arrays_alone(alone_set_t &set, ea_t ea, ea_t stop, matchvec_t &matches)
+{
+    alone_visitor_t visitor(matches);
+    qvector<uchar> mem;
+    mem.resize(SCAN_CHUNK_SIZE);
+    for (; ea < stop; ea += SCAN_CHUNK_SIZE)
+    {
+        show_addr(ea);
+        if (user_cancelled())
+        {
+            return;
+        }
+
+        const size_t size = (size_t) qmin((asize_t) (stop - ea), (asize_t) SCAN_CHUNK_SIZE);
+        ssize_t sizeRead = get_bytes(mem.begin(), size, ea, GMB_READALL);
+        visitor.base = set.base;
+        visitor.limit = set.limit;
+        for (size_t t = 0; t < set.streams.size() && sizeRead > 0; ++t)
+        {
+            if (!is_family_confirmed(set.tables[t]->algorithm))
+            {
+                visitor.ai = set.tables[t];
+                set.streams[t].feed(mem.begin(), sizeRead, visitor);
+            }
+        }
+
+        // a short read breaks the streams, they restart at the next chunk
+        if (sizeRead < (ssize_t) size)
+        {
+            restart_arrays_alone(set, ea + size, set.base + set.limit);
+        }
+    }
+}
+
+// each table is a stream search over the chunks of a range: the tables
+// across two chunks are found without reading the chunks again
+static void scan_arrays_alone(alone_set_t &set, const rangevec_t &ranges, matchvec_t &matches)
+{
+    for (size_t n = 0; n < ranges.size() && !set.tables.empty(); ++n)
+    {
+        // the matches starting in the range, a table may end after it
+        const ea_t start = ranges[n].start_ea;
+        const ea_t end = ranges[n].end_ea;
+        const ea_t stop = (BADADDR - end > set.overlap) ? end + set.overlap - 1 : BADADDR;
+        restart_arrays_alone(set, start, end);
+        feed_arrays_alone(set, start, stop, matches);
+        if (user_cancelled())
+        {
+            return;
+        }
+    }
+}
+
+// the first table of non_sparse_consts is kept at each address
+static void keep_first_tables(matchvec_t &matches)
+{
+    std::sort(matches.begin(), matches.end(), match_less);
+
+    size_t n = 0;
+    for (size_t i = 0; i < matches.size(); ++i)
+    {
+        if (0 == n || matches[n - 1].ea != matches[i].ea)
+        {
+            matches[n++] = matches[i];
+        }
+    }
+    matches.resize(n);
+}
+
+// add the tables searched alone to the matches of the others. The tables
+// shorter than min_shared bytes are searched alone too
+static void add_arrays_alone(const rangevec_t &ranges, matchvec_t &matches, size_t min_shared)
+{
+    alone_set_t set;
+    compile_arrays_alone(set, min_shared);
+    scan_arrays_alone(set, ranges, matches);
+    keep_first_tables(matches);
+}
+
+//--------------------------------------------------------------------------
+// find the tables in the ranges, byte by byte: the first byte of every
+// table is compared, then the whole table. The first table of
+// non_sparse_consts is kept at each address
+static void find_arrays_bytewise(const rangevec_t &ranges, matchvec_t &matches)
+{
+    for (size_t n = 0; n < ranges.size(); ++n)
+    {
+        for (ea_t ea = ranges[n].start_ea; ea < ranges[n].end_ea; ea = next_addr(ea))
+        {
+            if (0 == (ea % 0x1000))
+            {
+                show_addr(ea);
+                if (user_cancelled())
+                {
+                    return;
+                }
+            }
+
+            uchar b = get_byte(ea);
+
+            // check against normal constants
+            for (const array_info_t *ptr = non_sparse_consts; ptr->size != 0; ++ptr)
+            {
+                if (b != get_first_byte(ptr) || is_searched_alone(ptr) || is_family_confirmed(ptr->algorithm))
+                {
+                    continue;
+                }
+
+                if (match_array_pattern(ea, ptr))
+                {
+                    match_t &m = matches.push_back();
+                    m.ea = ea;
+                    m.ai = ptr;
+                    m.type = MATCH_ARRAY;
+                    break;
+                }
+            }
+        }
+    }
+
+    add_arrays_alone(ranges, matches, 0);
+}
+
+// collect the matches which start in the first 'limit' bytes of the chunk
+struct array_visitor_t : public wm_visitor_t
+{
+    const wu_manber_t &matcher;
+    ea_t base;
+    size_t limit;
+    matchvec_t matches;
+
+    array_visitor_t(const wu_manber_t &m) : matcher(m), base(0), limit(0) {}
+
+    virtual bool visit(size_t iPattern, size_t iOffset)
+    {
+        if (iOffset >= limit)
+        {
+            return true;
+        }
+
+        match_t &m = matches.push_back();
+        m.ea = base + iOffset;
+        m.ai = (const array_info_t *) matcher.pattern_ud(iPattern);
+        m.type = MATCH_ARRAY;
+        return true;
+    }
+};
+
+// the tables of WM_MIN_PATTERN bytes and more compiled into one Wu-Manber
+// matcher, false if there is none
+static bool compile_arrays_wu_manber(wu_manber_t &matcher)
+{
+    qvector<uchar> bytes;
+    for (const array_info_t *ptr = non_sparse_consts; ptr->size != 0; ++ptr)
+    {
+        // the short tables would cap the shifts of all the others
+        if (!is_searched_alone(ptr) && ptr->size * ptr->elsize >= WM_MIN_PATTERN && !is_family_confirmed(ptr->algorithm))
+        {
+            make_array_bytes(ptr, ptr->array, bytes);
+            matcher.add_pattern(bytes.begin(), bytes.size(), ptr);
+        }
+    }
+
+    return matcher.compile();
+}
+
+// the ranges read in chunks, the matches of the families confirmed since
+// the compilation are dropped. Several tables may match at an address
+static void scan_arrays_wu_manber(wu_manber_t &matcher, const rangevec_t &ranges, matchvec_t &matches)
+{
+    // a table starting in a range may end after it, as in the byte scan
+    const size_t overlap = matcher.max_match_len();
+
+    array_visitor_t visitor(matcher);
+    qvector<uchar> mem;
+    for (size_t n = 0; n < ranges.size(); ++n)
+    {
+        ea_t start = ranges[n].start_ea;
+        ea_t end = ranges[n].end_ea;
+        for (ea_t ea = start; ea < end; ea += SCAN_CHUNK_SIZE)
+        {
+            show_addr(ea);
+            if (user_cancelled())
+            {
+                break;
+            }
+
+            mem.resize(SCAN_CHUNK_SIZE + overlap);
+            ssize_t sizeRead = get_bytes(mem.begin(), mem.size(), ea, GMB_READALL);
+            if (sizeRead <= 0)
+            {
+                continue;
+            }
+
+            visitor.base = ea;
+            visitor.limit = (size_t) qmin((asize_t) (end - ea), (asize_t) SCAN_CHUNK_SIZE);
+            matcher.scan(mem.begin(), sizeRead, visitor);
+        }
+    }
+
+    // keep_first_tables sorts them with the others
+    for (size_t i = 0; i < visitor.matches.size(); ++i)
+    {
+        if (!is_family_confirmed(visitor.matches[i].ai->algorithm))
+        {
+            matches.push_back(visitor.matches[i]);
+        }
+    }
+}
+
+// same with all the tables compiled into one Wu-Manber matcher
+static void find_arrays_wu_manber(const rangevec_t &ranges, matchvec_t &matches)
+{
+    wu_manber_t matcher;
+    if (compile_arrays_wu_manber(matcher))
+    {
+        scan_arrays_wu_manber(matcher, ranges, matches);
+    }
+
+    add_arrays_alone(ranges, matches, WM_MIN_PATTERN);
+}
+
+// same with the native search of IDA: the tables are compiled into binary
+// patterns, BINPAT_BATCH per search. Before 8.0 the search does not tell
+// which pattern matched, the images are compared at the found address
+static void find_arrays_bin_search(const rangevec_t &ranges, matchvec_t &matches)
+{
+    qvector<const array_info_t *> tables;
+    for (const array_info_t *ptr = non_sparse_consts; ptr->size != 0; ++ptr)
+    {
+        if (!is_searched_alone(ptr) && !is_family_confirmed(ptr->algorithm))
+        {
+            tables.push_back(ptr);
+        }
+    }
+
+    matchvec_t found;
+    qvector<uchar> mem;
+    for (size_t first = 0; first < tables.size(); first += BINPAT_BATCH)
+    {
+        const size_t count = qmin((size_t) BINPAT_BATCH, tables.size() - first);
+        compiled_binpat_vec_t pats;
+        size_t overlap = 0;
+        for (size_t i = 0; i < count; ++i)
+        {
+            compiled_binpat_t &pat = pats.push_back();
+            make_array_bytes(tables[first + i], tables[first + i]->array, pat.bytes);
+            overlap = qmax(overlap, pat.bytes.size());
+        }
+
+        for (size_t n = 0; n < ranges.size(); ++n)
+        {
+            // the matches starting in the range, a table may end after it
+            const ea_t end = ranges[n].end_ea;
+            const ea_t search_end = (BADADDR - end > overlap) ? end + overlap : BADADDR;
+            for (ea_t ea = ranges[n].start_ea; ea < end; ++ea)
+            {
+                if (user_cancelled())
+                {
+                    return;
+                }
+
+                // a cancelled search returns BADADDR
+                const int flags = BIN_SEARCH_FORWARD | BIN_SEARCH_NOSHOW | BIN_SEARCH_CASE;
+#if IDA_SDK_VERSION >= 800
+                size_t idx;
+                ea = bin_search3(&idx, ea, search_end, pats, flags);
+                if (BADADDR == ea || ea >= end)
+                {
+                    break;
+                }
+
+                match_t &m = found.push_back();
+                m.ea = ea;
+                m.ai = tables[first + idx];
+                m.type = MATCH_ARRAY;
+#else
+                ea = bin_search2(ea, search_end, pats, flags);
+                if (BADADDR == ea || ea >= end)
+                {
+                    break;
+                }
+
+                mem.resize(overlap);
+                ssize_t sizeRead = get_bytes(mem.begin(), overlap, ea, GMB_READALL);
+                for (size_t i = 0; i < count; ++i)
+                {
+                    const qvector<uchar> &bytes = pats[i].bytes;
+                    if (sizeRead >= (ssize_t) bytes.size() && 0 == memcmp(mem.begin(), bytes.begin(), bytes.size()))
+                    {
+                        match_t &m = found.push_back();
+                        m.ea = ea;
+                        m.ai = tables[first + i];
+                        m.type = MATCH_ARRAY;
+                        break;
+                    }
+                }
+#endif
+            }
+        }
+    }
+
+    // the matches of an address by the order of the tables
+    std::sort(found.begin(), found.end(), match_less);
+    for (size_t i = 0; i < found.size(); ++i)
+    {
+        if (i == 0 || found[i - 1].ea != found[i].ea)
+        {
+            matches.push_back(found[i]);
+        }
+    }
+
+    add_arrays_alone(ranges, matches, 0);
+}
+
+// the engines of the table pass, ARRAY_ENGINE selects one
+struct array_engine_t
+{
+    const char *name;
+    void (*find)(const rangevec_t &ranges, matchvec_t &matches);
+};
+
+static const array_engine_t array_engines[] =
+{
+    { "byte scan",  find_arrays_bytewise },
+    { "Wu-Manber",  find_arrays_wu_manber },
+    { "bin_search", find_arrays_bin_search },
+};
+
+// find the tables in the ranges with the engine selected by ARRAY_ENGINE
+static int recognize_array_constants(const rangevec_t &ranges)
+{
+    matchvec_t matches;
+    array_engines[ARRAY_ENGINE].find(ranges, matches);
+
+    for (size_t i = 0; i < matches.size(); ++i)
+    {
+        report_match(matches[i]);
+    }
+
+    return (int) matches.size();
+}
+
+// time the table engines on the range, nothing is annotated
+static void benchmark_array_engines(ea_t ea1, ea_t ea2)
+{
+    msg_clear();
+    show_wait_box("Benchmark of the table engines in range 0x%a - 0x%a...", ea1, ea2);
+
+    asize_t skipped;
+    qvector<scan_range_t> plan;
+    get_scan_plan(ea1, ea2, plan, &skipped);
+
+    rangevec_t ranges;
+    get_plan_ranges(plan, -1, ENG_ARRAY, ranges);
+    asize_t size = 0;
+    for (size_t i = 0; i < ranges.size(); ++i)
+    {
+        size += ranges[i].size();
+    }
+
+    msg("[%s] - Benchmark of the table pass on 0x%a bytes:\n", PLUGIN_NAME, size);
+
+    // the other engines are checked against the byte scan
+    matchvec_t reference;
+    for (size_t e = 0; e < qnumber(array_engines) && !user_cancelled(); ++e)
+    {
+        matchvec_t matches;
+        uint64 t0 = get_nsec_stamp();
+        array_engines[e].find(ranges, matches);
+        uint64 t1 = get_nsec_stamp();
+
+        bool same = true;
+        if (0 == e)
+        {
+            reference.swap(matches);
+        }
+        else
+        {
+            same = reference.size() == matches.size();
+            for (size_t i = 0; same && i < matches.size(); ++i)
+            {
+                same = reference[i].ea == matches[i].ea && reference[i].ai == matches[i].ai;
+            }
+        }
+
+        msg("[%s] -     %s: %d ms, %d matches%s%s\n", PLUGIN_NAME, array_engines[e].name,
+            (int) ((t1 - t0) / 1000000), (int) (0 == e ? reference.size() : matches.size()),
+            same ? "" : ", the matches differ",
+            ARRAY_ENGINE == e ? " (selected)" : "");
+    }
+
+    hide_wait_box();
+}
+
+//--------------------------------------------------------------------------
+// the code and data of the libraries found by the table pass are skipped by
+// the next passes. Called again, only the new regions are reported
+static void exclude_library_regions()
+{
+    qvector<lib_range_t> libs;
+    get_library_ranges(found_matches, libs);
+
+    rangevec_t known;
+    known.swap(library_ranges);
+    for (size_t i = 0; i < libs.size(); ++i)
+    {
+        const lib_range_t &lib = libs[i];
+        library_ranges.push_back(lib.range);
+
+        size_t j;
+        for (j = 0; j < known.size() && !(known[j].contains(lib.range.start_ea) && lib.range.end_ea <= known[j].end_ea); ++j)
+        {
+        }
+        if (j < known.size())
+        {
+            continue;
+        }
+        msg("[%s] - 0x%a: %s library %s up to 0x%a, skipped by the next passes\n", PLUGIN_NAME,
+            lib.range.start_ea, lib.family, lib.code ? "code" : "data", lib.range.end_ea);
+    }
+    normalize_ranges(library_ranges);
+}
+
+// the engines after the table pass on the ranges of one priority. sparse:
+// the sparse matcher compiled once for all the priorities, null if none
+static int run_scan_engines(ea_t ea1, ea_t ea2, const qvector<scan_range_t> &plan, int priority, gapped_matcher_t *sparse)
+{
+    int count = 0;
+    rangevec_t ranges;
+
+    if (nullptr != sparse && !user_cancelled() && get_plan_ranges(plan, priority, ENG_SPARSE, ranges))
+    {
+        count += scan_sparse_constants(*sparse, ranges, 0);
+    }
+
+    if (!user_cancelled() && get_plan_ranges(plan, priority, ENG_OPERAND, ranges))
+    {
+        restrict_scans(ranges);
+        count += recognize_operand_constants(ea1, ea2);
+    }
+
+    if (!user_cancelled() && get_plan_ranges(plan, priority, ENG_POOL, ranges))
+    {
+        restrict_scans(ranges);
+        count += recognize_pool_constants(ea1, ea2);
+    }
+
+    if (!user_cancelled() && get_plan_ranges(plan, priority, ENG_OPCODE, ranges))
+    {
+        count += recognize_opcode_constants(ranges);
+    }
+
+    if (!user_cancelled() && get_plan_ranges(plan, priority, ENG_HW, ranges))
+    {
+        restrict_scans(ranges);
+        count += recognize_hw_crypto(ea1, ea2);
+    }
+
+    return count;
+}
+
+//--------------------------------------------------------------------------
+// try to find constants at the given address range
+// The segments are scanned by the priority and with the engines of their
+// class (policy.cpp). The table pass runs first on all of them.
+// SCAN_XREF_TRIAGE: only the tables and sparse arrays around the targets of
+// the data xrefs: from the longest table size before them, a reference may
+// point into a table, to the longest sparse span after them. The tables
+// starting in a range are read to their end by the table pass.
+// skip_libraries: see SCAN_SKIP_LIBRARIES
+// clear_output: false to keep the report of a previous pass
+static int recognize_constants(ea_t ea1, ea_t ea2, int mode, bool skip_libraries, bool clear_output)
+{
+    int count = 0;
+
+    if (clear_output)
+    {
+        msg_clear();
+    }
+    show_wait_box("Searching for crypto constants in range 0x%a - 0x%a...", ea1, ea2);
+    found_matches.clear();
+    library_ranges.clear();
+
+    asize_t skipped;
+    qvector<scan_range_t> plan;
+    get_scan_plan(ea1, ea2, plan, &skipped);
+    report_scan_plan(plan, skipped);
+
+    rangevec_t ranges;
+    get_plan_ranges(plan, -1, ENG_ARRAY, ranges);
+    if (SCAN_XREF_TRIAGE == mode)
+    {
+        rangevec_t segs;
+        segs.swap(ranges);
+        size_t targets = get_xref_ranges(segs, get_max_table_size(), get_sparse_span(), ranges);
+
+        asize_t size = 0;
+        for (size_t i = 0; i < ranges.size(); ++i)
+        {
+            size += ranges[i].size();
+        }
+        msg("[%s] - Triage: %d data xref targets, scanning 0x%a bytes in %d ranges\n",
+            PLUGIN_NAME, (int) targets, size, (int) ranges.size());
+    }
+
+    count += recognize_array_constants(ranges);
+
+    if (skip_libraries && !user_cancelled())
+    {
+        exclude_library_regions();
+    }
+
+    if (SCAN_XREF_TRIAGE == mode)
+    {
+        // the sparse arrays in the same windows, where the policy allows them
+        rangevec_t allowed, excluded, windows;
+        get_plan_ranges(plan, -1, ENG_SPARSE, allowed);
+        complement_ranges(allowed, excluded);
+        for (size_t i = 0; i < ranges.size(); ++i)
+        {
+            subtract_ranges(ranges[i].start_ea, ranges[i].end_ea, excluded, windows);
+        }
+
+        if (!user_cancelled())
+        {
+            count += recognize_sparse_constants(windows);
+        }
+    }
+    else
+    {
+        // the other engines, priority after priority
+        variantvec_t variants;
+        gapped_matcher_t sparse;
+        const bool has_sparse = compile_sparse_matcher(variants, sparse);
+        for (size_t i = 0; i < plan.size() && !user_cancelled(); )
+        {
+            int priority = plan[i].priority;
+            count += run_scan_engines(ea1, ea2, plan, priority, has_sparse ? &sparse : nullptr);
+            while (i < plan.size() && plan[i].priority == priority)
+            {
+                i++;
+            }
+        }
+    }
+
+    hide_wait_box();
+    int instances = report_instances();
+    found_matches.clear();
+    msg("[%s] - Found %d known constant arrays in total, in %d algorithm instances.\n",
+        PLUGIN_NAME, count, instances);
+
+    if (SCAN_FULL == mode && !user_cancelled() && get_plan_ranges(plan, -1, ENG_FUNCS, ranges))
+    {
+        restrict_scans(ranges);
+        rank_crypto_functions(ea1, ea2);
+    }
+
+    set_excluded_ranges(rangevec_t());
+    library_ranges.clear();
+
+    return count;
+}
+
+//--------------------------------------------------------------------------
+// which crypto is in the range, quickly: the table and sparse passes only,
+// on the ranges of the plan by priority, TRIAGE_STEP bytes at a time. The
+// tables are searched with the Wu-Manber matcher and the streams, compiled
+// once like the sparse matcher; the streams go on from a piece to the next
+// one of the same range. The signatures of a confirmed family are not
+// searched again. The scan stops when max_hits families are confirmed or
+// after budget_ms.
+// skip_libraries: the sparse pass skips the library regions found so far
+static int triage_constants(ea_t ea1, ea_t ea2, uint32 budget_ms, int max_hits, bool skip_libraries)
+{
+    int count = 0;
+    const uint64 start_time = get_nsec_stamp();
+    const uint64 deadline = start_time + (uint64) budget_ms * 1000000;
+
+    msg_clear();
+    show_wait_box("Triage of the crypto constants in range 0x%a - 0x%a...", ea1, ea2);
+    found_matches.clear();
+    library_ranges.clear();
+    confirmed_families.clear();
+
+    asize_t skipped;
+    qvector<scan_range_t> plan;
+    get_scan_plan(ea1, ea2, plan, &skipped);
+    report_scan_plan(plan, skipped);
+
+    variantvec_t variants;
+    gapped_matcher_t matcher;
+    const bool has_sparse = compile_sparse_matcher(variants, matcher);
+    const asize_t overlap = has_sparse ? get_sparse_span() : 0;
+
+    wu_manber_t tables;
+    const bool has_tables = compile_arrays_wu_manber(tables);
+    alone_set_t alone;
+    compile_arrays_alone(alone, WM_MIN_PATTERN);
+    qvector<ea_t> reported;     // addresses of the tables of the previous piece
+
+    asize_t total = 0;
+    for (size_t i = 0; i < plan.size(); ++i)
+    {
+        if (0 != (plan[i].engines & ENG_ARRAY))
+        {
+            total += plan[i].range.size();
+        }
+    }
+
+    asize_t covered = 0;
+    const char *stop = nullptr;
+    for (size_t i = 0; i < plan.size() && nullptr == stop; ++i)
+    {
+        const scan_range_t &r = plan[i];
+        if (0 == (r.engines & ENG_ARRAY))
+        {
+            continue;
+        }
+        restart_arrays_alone(alone, r.range.start_ea, r.range.end_ea);
+
+        for (ea_t ea = r.range.start_ea; ea < r.range.end_ea; )
+        {
+            if (user_cancelled())
+            {
+                stop = "cancelled";
+            }
+            else if (get_nsec_stamp() >= deadline)
+            {
+                stop = "time budget spent";
+            }
+            else if ((int) confirmed_families.size() >= max_hits)
+            {
+                stop = "hit limit reached";
+            }
+            if (nullptr != stop)
+            {
+                break;
+            }
+
+            ea_t end = (r.range.end_ea - ea > TRIAGE_STEP) ? ea + TRIAGE_STEP : r.range.end_ea;
+            rangevec_t piece;
+            piece.push_back(range_t(ea, end));
+            matchvec_t matches;
+            if (has_tables)
+            {
+                scan_arrays_wu_manber(tables, piece, matches);
+            }
+
+            // the last piece reads the tables starting in the range to their end
+            ea_t stop = end;
+            if (end == r.range.end_ea && alone.overlap > 1)
+            {
+                stop = (BADADDR - end > alone.overlap) ? end + alone.overlap - 1 : BADADDR;
+            }
+            feed_arrays_alone(alone, ea, stop, matches);
+            keep_first_tables(matches);
+
+            // a table across the previous piece ends in this one, it was
+            // reported if another one matched at its address
+            int found = 0;
+            for (size_t j = 0; j < matches.size(); ++j)
+            {
+                if (matches[j].ea < ea && std::binary_search(reported.begin(), reported.end(), matches[j].ea))
+                {
+                    continue;
+                }
+                report_match(matches[j]);
+                found++;
+            }
+            reported.clear();
+            for (size_t j = 0; j < matches.size(); ++j)
+            {
+                reported.push_back(matches[j].ea);
+            }
+            count += found;
+
+            if (skip_libraries && 0 != found && !user_cancelled())
+            {
+                exclude_library_regions();
+            }
+
+            // the sparse arrays starting in the piece, read up to their length
+            // after it
+            if (has_sparse && 0 != (r.engines & ENG_SPARSE))
+            {
+                asize_t tail = qmin(overlap, (asize_t) (r.range.end_ea - end));
+                rangevec_t parts;
+                subtract_ranges(ea, end + tail, library_ranges, parts);
+                for (size_t j = 0; j < parts.size(); ++j)
+                {
+                    piece[0] = parts[j];
+                    count += scan_sparse_constants(matcher, piece, parts[j].end_ea == end + tail ? tail : 0);
+                }
+            }
+
+            covered += end - ea;
+            ea = end;
+            update_confirmed_families();
+        }
+    }
+
+    hide_wait_box();
+    int instances = report_instances();
+    found_matches.clear();
+
+    int percent = (0 != total) ? (int) ((uint64) covered * 100 / total) : 100;
+    int elapsed = (int) ((get_nsec_stamp() - start_time) / 1000000);
+    msg("[%s] - Triage: covered 0x%a of 0x%a bytes (%d%%) in %d ms, %d families confirmed, %s\n",
+        PLUGIN_NAME, covered, total, percent, elapsed, (int) confirmed_families.size(),
+        nullptr != stop ? stop : "the plan is complete");
+    msg("[%s] - Found %d known constant arrays in total, in %d algorithm instances.\n",
+        PLUGIN_NAME, count, instances);
+
+    confirmed_families.clear();
+    library_ranges.clear();
+
+    return count;
+}
+
+//--------------------------------------------------------------------------
+// arg: SCAN_FULL or SCAN_XREF_TRIAGE, or SCAN_TIME_TRIAGE with its budget
+// and hit limit, each with SCAN_SKIP_LIBRARIES
+bool idaapi run(size_t arg)
+{
+    if (!auto_is_ok())
+    {
+        warning("IDA is still analysing !\nPlugin will start after autoanalysis is finished");
+        auto_wait();
+    }
+
+    ea_t ea1 = inf.min_ea;
+    ea_t ea2 = inf.max_ea;
+
+    read_range_selection(nullptr, &ea1, &ea2);     // if fails, inf.min_ea and inf.max_ea will be used
+
+    if (SCAN_BENCHMARK == (arg & SCAN_MODE_MASK))
+    {
+        benchmark_array_engines(ea1, ea2);
+        return true;
+    }
+
+    const bool skip_libraries = (arg & SCAN_SKIP_LIBRARIES) != 0;
+    if (SCAN_TIME_TRIAGE == (arg & SCAN_MODE_MASK))
+    {
+        uint32 budget_ms = (uint32) ((arg >> SCAN_BUDGET_SHIFT) & 0xFF) * 100;
+        int max_hits = (int) ((arg >> SCAN_HITS_SHIFT) & 0xFF);
+        triage_constants(ea1, ea2,
+                         0 != budget_ms ? budget_ms : TRIAGE_BUDGET_MS,
+                         0 != max_hits ? max_hits : TRIAGE_MAX_HITS,
+                         skip_libraries);
+        return true;
+    }
+
+    const bool triage = (SCAN_XREF_TRIAGE == (arg & SCAN_MODE_MASK));
+    if (triage)
+    {
+        int count = recognize_constants(ea1, ea2, SCAN_XREF_TRIAGE, skip_libraries, true);
+        if (ASKBTN_YES != ask_yn(ASKBTN_NO,
+                                 "HIDECANCEL\n"
+                                 "The triage found %d constant arrays used by the code.\n"
+                                 "Run the full scan too?", count))
+        {
+            return true;
+        }
+    }
+
+    // after a triage its report stays above the full one
+    recognize_constants(ea1, ea2, SCAN_FULL, skip_libraries, !triage);
 
     return true;
 }
@@ -426,6 +2074,7 @@ int idaapi init(void)
     verify_constants(non_sparse_consts);
     verify_constants(sparse_consts);
     verify_constants(operand_consts);
+    verify_opcode_constants(opcode_consts);
 #endif
 
     msg("\n=================================================================================\n"
@@ -446,7 +2095,14 @@ void idaapi term(void)
 }
 
 //--------------------------------------------------------------------------
-static const char *help = PLUGIN_NAME;
+static const char *help = PLUGIN_NAME "\n"
+                          "Argument 0: full scan\n"
+                          "Argument 1: triage, the tables used by the code first\n"
+                          "Add 256 to skip the CRT, libgcc2 and zlib code and data\n"
+                          "Argument 2: triage under a time budget, the budget in 100 ms\n"
+                          "in bits 16..23 (default 1 s), the families to confirm before\n"
+                          "stopping in bits 24..31 (default 8)\n"
+                          "Argument 3: benchmark of the table engines";
 static const char *comment = PLUGIN_NAME;
 static const char *wanted_name = PLUGIN_NAME;
 static const char *wanted_hotkey = "";
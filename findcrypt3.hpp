@@ -4,8 +4,10 @@
 #pragma once
 
 #include <pro.h>
+#include <range.hpp>
 
 #define IS_LITTLE_ENDIAN
+#define PLUGIN_NAME         "FindCrypt3"
 
 #if defined(__GNUC__) || defined(__MWERKS__)
     #define WORD64_AVAILABLE
@@ -31,6 +33,8 @@ struct array_info_t
     size_t big_endian;
     const char *name;
     const char *algorithm;
+    const void *mask;           // table pass: nullptr, or the layout of array with
+                                // 0 bits as wildcards, e.g. relocated pointers
 };
 
 extern const array_info_t non_sparse_consts[];
@@ -43,4 +47,238 @@ extern const array_info_t operand_consts[];
 // HTC: string constant
 #define ARR_SZ(x) x, sizeof(x), 1, 1, #x
 
+// Instruction byte signatures with a mask of the bits to compare (opcodes.cpp)
+struct opcode_info_t
+{
+    array_info_t ai;                // the bytes, elsize = 1
+    const uchar *mask;              // ai.size bytes, 0 bits are wildcards
+    int proc;                       // PLFM_... of the code
+};
+
+extern const opcode_info_t opcode_consts[];
+
+#define ARR_OPC(x) x, sizeof(x), 1, 0, #x
+
+//--------------------------------------------------------------------------
+// Derived forms of the constants (variants.cpp)
+#define VAR_NONE            0       // the constant itself
+#define VAR_NEG             1       // -x
+#define VAR_NOT             2       // ~x
+#define VAR_BSWAP           3       // byte swapped
+#define VAR_ROL8            4       // 32-bit rotations
+#define VAR_ROL16           5
+#define VAR_ROL24           6
+#define VAR_ROL32           7       // 64-bit with swapped halves
+#define VAR_UDIV            8       // magic multiplier of an unsigned division by x
+#define VAR_SDIV            9       // magic multiplier of a signed division by x
+#define VAR_COUNT           10
+
+struct variant_t
+{
+    const array_info_t *ai;
+    int type;                       // VAR_...
+    qvector<uint64> values;         // the elements after the transform
+};
+DECLARE_TYPE_AS_MOVABLE(variant_t);
+typedef qvector<variant_t> variantvec_t;
+
+const char *variant_name(int type);
+void expand_variants(const array_info_t *ai, variantvec_t &out);
+
+//--------------------------------------------------------------------------
+// Match records returned by the scanning engines
+#define MATCH_ARRAY         0       // whole array at ea
+#define MATCH_SPARSE        1       // sparse array, eas = address of each element
+#define MATCH_SPLIT_IMM     2       // 64-bit constant built from two 32-bit immediates, eas = lo, hi
+#define MATCH_OPERAND       3       // immediate or displacement of the instruction at ea, n = operand
+#define MATCH_POOL          4       // aligned data word at ea: literal pool or initialized data
+#define MATCH_OPCODE        5       // instruction bytes at ea, ai is the array_info_t of an opcode_info_t
+
+struct match_t
+{
+    ea_t ea;
+    const array_info_t *ai;
+    int type;                       // MATCH_...
+    int variant;                    // VAR_...
+    int n;                          // operand number for MATCH_OPERAND
+    eavec_t eas;
+
+    match_t() : ea(BADADDR), ai(nullptr), type(MATCH_ARRAY), variant(VAR_NONE), n(-1) {}
+};
+DECLARE_TYPE_AS_MOVABLE(match_t);
+typedef qvector<match_t> matchvec_t;
+
+// Algorithm instances: the matches grouped by algorithm and address (clusters.cpp)
+struct instance_t
+{
+    const char *algorithm;
+    ea_t start;
+    ea_t end;
+    size_t first;                   // matches of the instance in the order array
+    size_t nmatches;
+    int nsigs;                      // distinct signatures found
+    int expected;                   // signatures of the algorithm in the tables
+    int confidence;                 // 0..100
+};
+DECLARE_TYPE_AS_MOVABLE(instance_t);
+
+void cluster_matches(const matchvec_t &matches, qvector<instance_t> &instances, qvector<size_t> &order);
+
+// Scan policy of the segment classes (policy.cpp)
+#define SEGCLASS_CODE       0
+#define SEGCLASS_RODATA     1
+#define SEGCLASS_DATA       2
+#define SEGCLASS_BSS        3
+#define SEGCLASS_RESOURCE   4
+#define SEGCLASS_OVERLAY    5
+#define SEGCLASS_EXTERN     6
+#define SEGCLASS_COUNT      7
+
+// engines, in the order they are run
+#define ENG_ARRAY           0x01    // tables
+#define ENG_SPARSE          0x02    // sparse arrays
+#define ENG_OPERAND         0x04    // operand constants of the instructions
+#define ENG_POOL            0x08    // operand constants as data words
+#define ENG_OPCODE          0x10    // opcode signatures
+#define ENG_HW              0x20    // hardware crypto instructions
+#define ENG_FUNCS           0x40    // crypto-likelihood of the functions
+
+struct scan_range_t
+{
+    range_t range;
+    int segclass;                   // SEGCLASS_...
+    int priority;                   // lower first
+    uint32 engines;                 // ENG_...
+};
+DECLARE_TYPE_AS_MOVABLE(scan_range_t);
+
+void get_scan_plan(ea_t ea1, ea_t ea2, qvector<scan_range_t> &plan, asize_t *skipped);
+const char *get_segclass_name(int segclass);
+
+// Code and data of the libraries found by their tables (libranges.cpp)
+struct lib_range_t
+{
+    range_t range;
+    const char *family;             // algorithm of the tables
+    bool code;                      // the functions using the tables, else the tables
+};
+DECLARE_TYPE_AS_MOVABLE(lib_range_t);
+
+void get_library_ranges(const matchvec_t &matches, qvector<lib_range_t> &ranges);
+ea_t find_dref_target(ea_t ea, ea_t end);
+
+//--------------------------------------------------------------------------
+// Immediate and displacement operands of the code (opscan.cpp)
+struct imm_ref_t
+{
+    ea_t ea;                        // instruction address
+    uint64 value;
+    uint32 insn;                    // sequence number of the instruction in the scan
+    uchar n;                        // operand number
+    uchar type;                     // o_imm or o_displ
+};
+DECLARE_TYPE_AS_MOVABLE(imm_ref_t);
+typedef qvector<imm_ref_t> immvec_t;
+
+// filter of the collected values, must be thread safe
+typedef bool imm_filter_t(uint64 value);
+
+bool collect_immediates(ea_t ea1, ea_t ea2, immvec_t &refs, imm_filter_t *filter);
+bool is_weak_value(uint64 v, size_t elsize);
+const variantvec_t &get_operand_variants();
+void prepare_operand_tables();
+bool is_operand_candidate(uint64 value);
+bool is_risc_operand_candidate(uint64 value);
+void match_operand_value(ea_t ea, uint64 value, size_t elsize, int type, matchvec_t &matches);
+void match_split_immediates(const immvec_t &refs, matchvec_t &matches);
+void match_operand_constants(const immvec_t &refs, matchvec_t &matches, bool with_sparse);
+
+// Snapshots of the segments, cut into slices for the worker threads
+struct seg_slice_t
+{
+    const uchar *buf;               // points into the snapshot
+    size_t size;                    // decode the instructions starting in [0, size)
+    size_t avail;                   // readable bytes from buf, up to the end of the snapshot
+    ea_t ea;
+    int bitness;                    // of the segment: 0, 1 or 2
+};
+DECLARE_TYPE_AS_MOVABLE(seg_slice_t);
+typedef qvector<qvector<uchar> > snapshotvec_t;
+
+bool snapshot_segments(ea_t ea1, ea_t ea2, size_t slice_size, bool code_only,
+                       snapshotvec_t &snapshots, qvector<seg_slice_t> &slices);
+
+// ranges skipped by snapshot_segments() and collect_immediates()
+void set_excluded_ranges(const rangevec_t &ranges);
+void subtract_excluded(ea_t start, ea_t end, rangevec_t &out);
+void normalize_ranges(rangevec_t &ranges);
+void subtract_ranges(ea_t start, ea_t end, const rangevec_t &excluded, rangevec_t &out);
+
+// Fast immediate extraction for x86/x64 code (x86imm.cpp)
+struct x86_insn_t
+{
+    uchar map;                      // 0: one byte, 1: 0F, 2: 0F 38, 3: 0F 3A
+    uchar op;
+    uchar modrm;                    // if has_modrm
+    bool has_modrm;
+    bool vex;                       // VEX or EVEX encoded
+    bool is_rel;                    // relative branch or call
+    sval_t rel;                     // its displacement from the next instruction
+};
+
+bool collect_x86_immediates(ea_t ea1, ea_t ea2, immvec_t &refs, imm_filter_t *filter);
+size_t x86_insn_length(const uchar *p, size_t avail, bool is64, x86_insn_t *insn);
+
+// Constants built by instruction pairs on ARM, AArch64, MIPS and RISC-V (riscimm.cpp)
+bool is_risc_processor();
+bool collect_risc_immediates(ea_t ea1, ea_t ea2, immvec_t &refs, imm_filter_t *filter);
+
+// Hardware crypto instructions: AES-NI, SHA-NI, ARMv8 crypto... (hwcrypto.cpp)
+struct hw_insn_t
+{
+    const char *mnem;
+    const char *algorithm;
+};
+
+struct hw_hit_t
+{
+    ea_t ea;
+    const hw_insn_t *insn;
+};
+DECLARE_TYPE_AS_MOVABLE(hw_hit_t);
+typedef qvector<hw_hit_t> hwhitvec_t;
+
+bool collect_hw_crypto(ea_t ea1, ea_t ea2, hwhitvec_t &hits);
+
+// Instruction mix and crypto likelihood of the functions (funcscore.cpp)
+struct func_score_t
+{
+    ea_t start;
+    uint32 insns;
+    uint32 xors;                    // xor, pxor... but not the register clears
+    uint32 rots;                    // rol, ror, shld, shrd, rorx...
+    uint32 shifts;
+    uint32 adds;                    // add, sub, adc, sbb, neg, padd...
+    uint32 logic;                   // and, or, not, bswap...
+    uint32 calls;
+    uint32 loops;                   // backward branches
+    int score;                      // 0..100
+
+    func_score_t() : start(BADADDR), insns(0), xors(0), rots(0), shifts(0), adds(0),
+                     logic(0), calls(0), loops(0), score(0) {}
+};
+DECLARE_TYPE_AS_MOVABLE(func_score_t);
+
+bool score_functions(ea_t ea1, ea_t ea2, qvector<func_score_t> &scores);
+
+// Operand constants stored as aligned data words (poolscan.cpp)
+bool match_pool_constants(ea_t ea1, ea_t ea2, matchvec_t &matches);
+
+//--------------------------------------------------------------------------
+// Worker threads (workers.cpp)
+typedef void idaapi worker_fn_t(void *ud, size_t idx);
+
+size_t get_worker_count();
+void run_workers(worker_fn_t *fn, void *ud, size_t count);
+
 #endif  // _FINDCRYPT_HPP_
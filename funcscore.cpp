@@ -0,0 +1,351 @@
+// Crypto likelihood of the functions
+//
+// Custom and table-less ciphers have no constants to find, but their code
+// looks alike: long runs of xor, rotations, shifts and additions, inside
+// loops, with few calls. The code segments are read into snapshot buffers
+// and walked once with the x86/x64 length decoder on the worker threads.
+// Every instruction is counted in the function chunk containing it, the
+// chunks are then summed per function and each function gets a score.
+
+#include <algorithm>
+
+#include <pro.h>
+#include <ida.hpp>
+#include <idp.hpp>
+#include <funcs.hpp>
+
+#include "findcrypt3.hpp"
+
+#define FS_SLICE_SIZE       0x100000    // bytes decoded by one job
+#define FS_MIN_INSNS        32          // smaller functions are not scored
+#define FS_FULL_DENSITY     60          // weighted mix per 100 instructions of a score of 100
+#define FS_CALL_RATIO       8           // weighted mix per call, below it the score is reduced
+
+// instruction kinds
+#define FK_OTHER        0
+#define FK_XOR          1
+#define FK_ROT          2
+#define FK_SHIFT        3
+#define FK_ADD          4
+#define FK_LOGIC        5
+#define FK_CALL         6
+
+//--------------------------------------------------------------------------
+// kind of a decoded instruction, the operand forms are not checked
+static int classify_x86(const x86_insn_t &insn)
+{
+    const uchar reg = (insn.modrm >> 3) & 7;
+    const bool same_regs = (insn.modrm >> 6) == 3 && reg == (insn.modrm & 7);
+
+    if (0 == insn.map)
+    {
+        uchar op = insn.op;
+        if (op <= 0x3F && (op & 7) < 6)
+        {
+            switch (op >> 3)
+            {
+                case 0: case 2: case 3: case 5:         // add, adc, sbb, sub
+                    return FK_ADD;
+                case 1: case 4:                         // or, and
+                    return FK_LOGIC;
+                case 6:                                 // xor r, r clears the register
+                    return ((op & 7) < 4 && same_regs) ? FK_OTHER : FK_XOR;
+                default:                                // cmp
+                    return FK_OTHER;
+            }
+        }
+
+        switch (op)
+        {
+            case 0x80: case 0x81: case 0x83:
+                switch (reg)
+                {
+                    case 0: case 2: case 3: case 5:
+                        return FK_ADD;
+                    case 1: case 4:
+                        return FK_LOGIC;
+                    case 6:
+                        return FK_XOR;
+                }
+                return FK_OTHER;
+            case 0xC0: case 0xC1: case 0xD0: case 0xD1: case 0xD2: case 0xD3:
+                return (reg < 4) ? FK_ROT : FK_SHIFT;   // rol, ror, rcl, rcr / shl, shr, sal, sar
+            case 0xF6: case 0xF7:
+                return (2 == reg) ? FK_LOGIC : ((3 == reg) ? FK_ADD : FK_OTHER);
+            case 0xE8:
+                return FK_CALL;
+            case 0xFF:
+                return (2 == reg || 3 == reg) ? FK_CALL : FK_OTHER;
+        }
+        return FK_OTHER;
+    }
+
+    if (1 == insn.map)
+    {
+        switch (insn.op)
+        {
+            case 0xA4: case 0xA5: case 0xAC: case 0xAD:             // shld, shrd
+                return FK_ROT;
+            case 0xC8: case 0xC9: case 0xCA: case 0xCB:             // bswap
+            case 0xCC: case 0xCD: case 0xCE: case 0xCF:
+            case 0x54: case 0x55: case 0x56:                        // andps, andnps, orps
+            case 0xDB: case 0xDF: case 0xEB:                        // pand, pandn, por
+                return FK_LOGIC;
+            case 0x57: case 0xEF:                                   // xorps, pxor
+                return (!insn.vex && same_regs) ? FK_OTHER : FK_XOR;
+            case 0xD4: case 0xFA: case 0xFB: case 0xFC: case 0xFD: case 0xFE:
+                return FK_ADD;                                      // padd, psub
+            case 0xD1: case 0xD2: case 0xD3: case 0xE1: case 0xE2:  // psrl, psra, psll
+            case 0xF1: case 0xF2: case 0xF3:
+                return FK_SHIFT;
+            case 0x71: case 0x72: case 0x73:                        // shift by imm8, vprold/vprord
+                return (insn.vex && 0x72 == insn.op && reg < 2) ? FK_ROT : FK_SHIFT;
+        }
+        return FK_OTHER;
+    }
+
+    if (2 == insn.map && insn.vex)
+    {
+        switch (insn.op)
+        {
+            case 0xF7: case 0x45: case 0x46: case 0x47:             // shlx, sarx, shrx, vpsrlv...
+                return FK_SHIFT;
+            case 0x14: case 0x15:                                   // vprorv, vprolv
+                return FK_ROT;
+        }
+        return FK_OTHER;
+    }
+
+    if (3 == insn.map && insn.vex && 0xF0 == insn.op)               // rorx
+    {
+        return FK_ROT;
+    }
+
+    return FK_OTHER;
+}
+
+//--------------------------------------------------------------------------
+// function chunks sorted by address
+struct func_range_t
+{
+    ea_t start;
+    ea_t end;
+    size_t func;                // index in the result
+};
+DECLARE_TYPE_AS_MOVABLE(func_range_t);
+
+static bool range_less(const func_range_t &a, const func_range_t &b)
+{
+    return a.start < b.start;
+}
+
+struct fs_job_t
+{
+    seg_slice_t slice;
+    const func_range_t *ranges;
+    size_t nranges;
+    size_t first;               // range of feats[0]
+    qvector<func_score_t> feats;
+};
+DECLARE_TYPE_AS_MOVABLE(fs_job_t);
+
+static void idaapi fs_worker(void *ud, size_t idx)
+{
+    fs_job_t &job = ((fs_job_t *) ud)[idx];
+    const seg_slice_t &slice = job.slice;
+    const bool is64 = (2 == slice.bitness);
+    const func_range_t *ranges = job.ranges;
+    const func_range_t *end = ranges + job.nranges;
+
+    // first chunk ending after the slice start, then follow the addresses
+    func_range_t key;
+    key.start = slice.ea;
+    const func_range_t *r = std::upper_bound(ranges, end, key, range_less);
+    if (r != ranges && r[-1].end > slice.ea)
+    {
+        --r;
+    }
+    job.first = r - ranges;
+
+    x86_insn_t insn;
+    for (size_t off = 0; off < slice.size && r != end; )
+    {
+        size_t len = x86_insn_length(slice.buf + off, slice.avail - off, is64, &insn);
+        if (0 == len)
+        {
+            off++;
+            continue;
+        }
+
+        ea_t ea = slice.ea + off;
+        off += len;
+        while (r != end && r->end <= ea)
+        {
+            ++r;
+        }
+        if (r == end || ea < r->start)
+        {
+            continue;
+        }
+
+        size_t n = r - ranges - job.first;
+        if (n >= job.feats.size())
+        {
+            job.feats.resize(n + 1);
+        }
+
+        func_score_t &f = job.feats[n];
+        f.insns++;
+        switch (classify_x86(insn))
+        {
+            case FK_XOR:   f.xors++;   break;
+            case FK_ROT:   f.rots++;   break;
+            case FK_SHIFT: f.shifts++; break;
+            case FK_ADD:   f.adds++;   break;
+            case FK_LOGIC: f.logic++;  break;
+            case FK_CALL:  f.calls++;  break;
+        }
+
+        // a backward branch inside the chunk closes a loop
+        if (insn.is_rel && insn.rel < 0 && !(0 == insn.map && 0xE8 == insn.op))
+        {
+            ea_t target = ea + len + insn.rel;
+            if (target >= r->start)
+            {
+                f.loops++;
+            }
+        }
+    }
+}
+
+//--------------------------------------------------------------------------
+// 0..100 from the features: density of the crypto instructions, halved
+// without loops and reduced in the functions made mostly of calls
+static int compute_score(const func_score_t &f)
+{
+    uint64 weighted = 2 * f.xors + 3 * f.rots + 2 * f.shifts + f.adds + f.logic;
+    uint64 score = weighted * 100 * 100 / ((uint64) f.insns * FS_FULL_DENSITY);
+    if (0 == f.loops)
+    {
+        score /= 2;
+    }
+    if (weighted < (uint64) f.calls * FS_CALL_RATIO)
+    {
+        score = score * weighted / ((uint64) f.calls * FS_CALL_RATIO);
+    }
+    return (int) qmin(score, (uint64) 100);
+}
+
+static bool score_greater(const func_score_t &a, const func_score_t &b)
+{
+    return a.score != b.score ? a.score > b.score : a.start < b.start;
+}
+
+//--------------------------------------------------------------------------
+// score the functions with at least FS_MIN_INSNS instructions in the range,
+// sorted by decreasing score. Only x86/x64 code is supported.
+// returns false if cancelled by the user
+bool score_functions(ea_t ea1, ea_t ea2, qvector<func_score_t> &scores)
+{
+    scores.clear();
+    if (PLFM_386 != PH.id)
+    {
+        return true;
+    }
+
+    // the kernel is not thread safe: the chunks are listed here
+    qvector<func_range_t> ranges;
+    for (size_t i = 0; i < get_fchunk_qty(); ++i)
+    {
+        func_t *chunk = getn_fchunk((int) i);
+        if (nullptr == chunk || chunk->end_ea <= ea1 || chunk->start_ea >= ea2)
+        {
+            continue;
+        }
+
+        ea_t owner = is_func_tail(chunk) ? chunk->owner : chunk->start_ea;
+        int func = get_func_num(owner);
+        if (func < 0)
+        {
+            continue;
+        }
+
+        func_range_t &r = ranges.push_back();
+        r.start = chunk->start_ea;
+        r.end = chunk->end_ea;
+        r.func = func;
+    }
+    if (ranges.empty())
+    {
+        return true;
+    }
+    std::sort(ranges.begin(), ranges.end(), range_less);
+
+    snapshotvec_t snapshots;
+    qvector<seg_slice_t> slices;
+    if (!snapshot_segments(ea1, ea2, FS_SLICE_SIZE, true, snapshots, slices))
+    {
+        return false;
+    }
+
+    qvector<fs_job_t> jobs;
+    for (size_t i = 0; i < slices.size(); ++i)
+    {
+        // no 16-bit code
+        if (0 == slices[i].bitness)
+        {
+            continue;
+        }
+
+        fs_job_t &job = jobs.push_back();
+        job.slice = slices[i];
+        job.ranges = ranges.begin();
+        job.nranges = ranges.size();
+        job.first = 0;
+    }
+
+    run_workers(fs_worker, jobs.begin(), jobs.size());
+
+    // a chunk cut by a slice has a part in two jobs
+    qvector<func_score_t> funcs;
+    funcs.resize(get_func_qty());
+    for (size_t i = 0; i < jobs.size(); ++i)
+    {
+        const fs_job_t &job = jobs[i];
+        for (size_t j = 0; j < job.feats.size(); ++j)
+        {
+            const func_score_t &s = job.feats[j];
+            func_score_t &d = funcs[ranges[job.first + j].func];
+            d.insns  += s.insns;
+            d.xors   += s.xors;
+            d.rots   += s.rots;
+            d.shifts += s.shifts;
+            d.adds   += s.adds;
+            d.logic  += s.logic;
+            d.calls  += s.calls;
+            d.loops  += s.loops;
+        }
+    }
+
+    for (size_t i = 0; i < funcs.size(); ++i)
+    {
+        func_score_t &f = funcs[i];
+        if (f.insns < FS_MIN_INSNS)
+        {
+            continue;
+        }
+
+        func_t *pfn = getn_func(i);
+        if (nullptr == pfn)
+        {
+            continue;
+        }
+
+        f.start = pfn->start_ea;
+        f.score = compute_score(f);
+        scores.push_back(f);
+    }
+
+    std::sort(scores.begin(), scores.end(), score_greater);
+    return true;
+}
@@ -3,76 +3,495 @@
 // http://www.cs.rpi.edu/~musser/gp/gensearch/index.html
 //
 
+#include <algorithm>
+
 #include <windows.h>
 #include <pro.h>
-#include <kernwin.hpp>
 
-#include "findcrypt3.hpp"
+#include "hal_search.hpp"
 
-#define HASH_RANGE_MAX  512
+#define HASH_BITS       9
+#define HASH_RANGE_MAX  (1 << HASH_BITS)
 #define SUFFIX_SIZE     2
 
-static inline ssize_t Hash(PBYTE pData)
+#ifdef HAL_SEARCH_STATS
+size_t hal_search_candidates = 0;
+#define COUNT_CANDIDATE()   (hal_search_candidates++)
+#else
+#define COUNT_CANDIDATE()
+#endif
+
+//--------------------------------------------------------------------------
+// Short patterns
+//
+// The first and the last byte of the pattern are compared at 16 (SSE2) or
+// 32 (AVX2) offsets at once, the middle bytes only at the offsets where
+// both match. AVX2 is used when the CPU has it.
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define HAL_USE_SSE2
+#include <emmintrin.h>
+#if defined(_MSC_VER)
+#define HAL_USE_AVX2
+#define HAL_AVX2_TARGET
+#include <intrin.h>
+#include <immintrin.h>
+#elif defined(__GNUC__)
+#define HAL_USE_AVX2
+#define HAL_AVX2_TARGET __attribute__((target("avx2")))
+#include <immintrin.h>
+#endif
+#endif
+
+#define SHORT_PATTERN_MAX   32      // longer patterns go to SearchHashed2
+
+static inline int LowestBit(uint32 bits)
+{
+#if defined(_MSC_VER)
+    unsigned long k;
+    _BitScanForward(&k, bits);
+    return (int) k;
+#else
+    return __builtin_ctz(bits);
+#endif
+}
+
+// offset of the pattern in pSrc at or after iStart, scalar
+static ssize_t SearchShortTail(const BYTE *pSrc, ssize_t iSrcLen, const BYTE *pPattern, ssize_t iPatternLen, ssize_t iStart)
+{
+    for (ssize_t i = iStart; i <= iSrcLen - iPatternLen; i++)
+    {
+        if (pSrc[i] != pPattern[0])
+            continue;
+        COUNT_CANDIDATE();
+        if (0 == memcmp(pSrc + i + 1, pPattern + 1, iPatternLen - 1))
+            return i;
+    }
+    return -1;
+}
+
+#ifdef HAL_USE_SSE2
+static ssize_t SearchShortSse2(const BYTE *pSrc, ssize_t iSrcLen, const BYTE *pPattern, ssize_t iPatternLen)
+{
+    const __m128i vFirst = _mm_set1_epi8((char) pPattern[0]);
+    const __m128i vLast = _mm_set1_epi8((char) pPattern[iPatternLen - 1]);
+
+    ssize_t i = 0;
+    for (; i + iPatternLen - 1 + 16 <= iSrcLen; i += 16)
+    {
+        __m128i x = _mm_loadu_si128((const __m128i *) (pSrc + i));
+        __m128i y = _mm_loadu_si128((const __m128i *) (pSrc + i + iPatternLen - 1));
+        uint32 bits = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(x, vFirst), _mm_cmpeq_epi8(y, vLast)));
+        while (0 != bits)
+        {
+            ssize_t k = i + LowestBit(bits);
+            COUNT_CANDIDATE();
+            if (iPatternLen <= 2 || 0 == memcmp(pSrc + k + 1, pPattern + 1, iPatternLen - 2))
+                return k;
+            bits &= bits - 1;
+        }
+    }
+
+    return SearchShortTail(pSrc, iSrcLen, pPattern, iPatternLen, i);
+}
+#endif
+
+#ifdef HAL_USE_AVX2
+HAL_AVX2_TARGET
+static ssize_t SearchShortAvx2(const BYTE *pSrc, ssize_t iSrcLen, const BYTE *pPattern, ssize_t iPatternLen)
+{
+    const __m256i vFirst = _mm256_set1_epi8((char) pPattern[0]);
+    const __m256i vLast = _mm256_set1_epi8((char) pPattern[iPatternLen - 1]);
+
+    ssize_t i = 0;
+    for (; i + iPatternLen - 1 + 32 <= iSrcLen; i += 32)
+    {
+        __m256i x = _mm256_loadu_si256((const __m256i *) (pSrc + i));
+        __m256i y = _mm256_loadu_si256((const __m256i *) (pSrc + i + iPatternLen - 1));
+        uint32 bits = (uint32) _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(x, vFirst), _mm256_cmpeq_epi8(y, vLast)));
+        while (0 != bits)
+        {
+            ssize_t k = i + LowestBit(bits);
+            COUNT_CANDIDATE();
+            if (iPatternLen <= 2 || 0 == memcmp(pSrc + k + 1, pPattern + 1, iPatternLen - 2))
+                return k;
+            bits &= bits - 1;
+        }
+    }
+
+    return SearchShortTail(pSrc, iSrcLen, pPattern, iPatternLen, i);
+}
+
+// AVX2 and the OS saving the YMM registers
+static bool HasAvx2()
+{
+#if defined(_MSC_VER)
+    int regs[4];
+    __cpuid(regs, 0);
+    if (regs[0] < 7)
+        return false;
+    __cpuid(regs, 1);
+    const int OSXSAVE_AVX = (1 << 27) | (1 << 28);
+    if ((regs[2] & OSXSAVE_AVX) != OSXSAVE_AVX || (_xgetbv(0) & 6) != 6)
+        return false;
+    __cpuidex(regs, 7, 0);
+    return 0 != (regs[1] & (1 << 5));
+#else
+    return 0 != __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+static ssize_t SearchShort(const BYTE *pSrc, ssize_t iSrcLen, const BYTE *pPattern, ssize_t iPatternLen)
+{
+    if ((iSrcLen <= 0) || (iPatternLen <= 0) || (iPatternLen > iSrcLen))
+        return -1;
+
+#ifdef HAL_USE_AVX2
+    static const bool bAvx2 = HasAvx2();
+    if (bAvx2)
+        return SearchShortAvx2(pSrc, iSrcLen, pPattern, iPatternLen);
+#endif
+#ifdef HAL_USE_SSE2
+    return SearchShortSse2(pSrc, iSrcLen, pPattern, iPatternLen);
+#else
+    return SearchShortTail(pSrc, iSrcLen, pPattern, iPatternLen, 0);
+#endif
+}
+
+//--------------------------------------------------------------------------
+// Long patterns
+//
+// Two-Way search (Crochemore-Perrin) with a shift table on the last two
+// bytes of the window: linear in the worst case, sublinear on average, and
+// the extra memory is the TWOWAY_HASH_SIZE shifts whatever the pattern
+// length. A table of several KB holds most byte values near its end, the
+// pairs give much longer shifts than the last byte alone.
+
+#define TWOWAY_HASH_SIZE    4096
+
+static inline size_t PairHash(const BYTE *pData)
+{
+    return ((((size_t) pData[-1]) << 4) ^ pData[0]) & (TWOWAY_HASH_SIZE - 1);
+}
+
+// position of the critical factorization of the pattern, *pPeriod receives
+// the period of its right part
+static size_t CriticalFactorization(const BYTE *pPattern, size_t iPatternLen, size_t *pPeriod)
+{
+    // maximal suffix for the byte order, then for the reverse order
+    size_t iMaxSuffix = (size_t) -1;
+    size_t j = 0, k = 1, p = 1;
+    while (j + k < iPatternLen)
+    {
+        BYTE a = pPattern[j + k];
+        BYTE b = pPattern[iMaxSuffix + k];
+        if (a < b)
+        {
+            j += k;
+            k = 1;
+            p = j - iMaxSuffix;
+        }
+        else if (a == b)
+        {
+            if (k != p)
+                ++k;
+            else
+            {
+                j += p;
+                k = 1;
+            }
+        }
+        else
+        {
+            iMaxSuffix = j++;
+            k = p = 1;
+        }
+    }
+    *pPeriod = p;
+
+    size_t iMaxSuffixRev = (size_t) -1;
+    j = 0, k = 1, p = 1;
+    while (j + k < iPatternLen)
+    {
+        BYTE a = pPattern[j + k];
+        BYTE b = pPattern[iMaxSuffixRev + k];
+        if (b < a)
+        {
+            j += k;
+            k = 1;
+            p = j - iMaxSuffixRev;
+        }
+        else if (a == b)
+        {
+            if (k != p)
+                ++k;
+            else
+            {
+                j += p;
+                k = 1;
+            }
+        }
+        else
+        {
+            iMaxSuffixRev = j++;
+            k = p = 1;
+        }
+    }
+
+    // the longer of the two suffixes
+    if (iMaxSuffixRev + 1 < iMaxSuffix + 1)
+        return iMaxSuffix + 1;
+
+    *pPeriod = p;
+    return iMaxSuffixRev + 1;
+}
+
+// the pair shifts of a pattern of at least SUFFIX_SIZE bytes, TWOWAY_HASH_SIZE
+// entries, and its factorization. *pbPeriodic is set when the left part
+// repeats in the right one
+static void ComputeTwoWayTables(const BYTE *pPattern, size_t iPatternLen, size_t *aShift,
+                                size_t *piSuffix, size_t *piPeriod, bool *pbPeriodic)
+{
+    const size_t m = iPatternLen;
+    size_t iSuffix = CriticalFactorization(pPattern, m, piPeriod);
+
+    // a pair absent from the pattern, or only at its start, shifts by m - 1
+    for (size_t i = 0; i < TWOWAY_HASH_SIZE; i++)
+        aShift[i] = m - 1;
+    for (size_t i = 1; i < m; i++)
+        aShift[PairHash(pPattern + i)] = m - i - 1;
+
+    *pbPeriodic = (0 == memcmp(pPattern, pPattern + *piPeriod, iSuffix));
+    if (!*pbPeriodic)
+        *piPeriod = qmax(iSuffix, m - iSuffix) + 1;
+    *piSuffix = iSuffix;
+}
+
+static ssize_t SearchTwoWay(const BYTE *pSrc, ssize_t iSrcLen, const BYTE *pPattern, ssize_t iPatternLen,
+                            const size_t *aShift, size_t iSuffix, size_t iPeriod, bool bPeriodic)
+{
+    if ((iSrcLen <= 0) || (iPatternLen <= 0) || (iPatternLen > iSrcLen))
+        return -1;
+
+    if (iPatternLen < SUFFIX_SIZE)
+        return SearchShort(pSrc, iSrcLen, pPattern, iPatternLen);
+
+    const size_t m = iPatternLen;
+    const size_t iLast = iSrcLen - iPatternLen;
+    size_t i, j = 0;
+    if (bPeriodic)
+    {
+        // periodic pattern: the prefix matched before the shift by the
+        // period is not compared again
+        size_t iMemory = 0;
+        while (j <= iLast)
+        {
+            // the pair shift is safe by itself: unlike a last byte shift it
+            // does not tell which byte of the period is out of place
+            size_t iShift = aShift[PairHash(pSrc + j + m - 1)];
+            if (0 != iShift)
+            {
+                iMemory = 0;
+                j += iShift;
+                continue;
+            }
+
+            // a zero shift is a hashed pair, the last byte is compared too
+            COUNT_CANDIDATE();
+            i = qmax(iSuffix, iMemory);
+            while (i < m && pPattern[i] == pSrc[i + j])
+                ++i;
+
+            if (m <= i)
+            {
+                i = iSuffix - 1;
+                while (iMemory < i + 1 && pPattern[i] == pSrc[i + j])
+                    --i;
+                if (i + 1 < iMemory + 1)
+                    return j;
+
+                j += iPeriod;
+                iMemory = m - iPeriod;
+            }
+            else
+            {
+                j += i - iSuffix + 1;
+                iMemory = 0;
+            }
+        }
+    }
+    else
+    {
+        while (j <= iLast)
+        {
+            size_t iShift = aShift[PairHash(pSrc + j + m - 1)];
+            if (0 != iShift)
+            {
+                j += iShift;
+                continue;
+            }
+
+            COUNT_CANDIDATE();
+            i = iSuffix;
+            while (i < m && pPattern[i] == pSrc[i + j])
+                ++i;
+
+            if (m <= i)
+            {
+                i = iSuffix - 1;
+                while (i != (size_t) -1 && pPattern[i] == pSrc[i + j])
+                    --i;
+                if (i == (size_t) -1)
+                    return j;
+
+                j += iPeriod;
+            }
+            else
+            {
+                j += i - iSuffix + 1;
+            }
+        }
+    }
+
+    return -1;
+}
+
+// same with the tables built for this search
+static ssize_t SearchTwoWay(const BYTE *pSrc, ssize_t iSrcLen, const BYTE *pPattern, ssize_t iPatternLen)
+{
+    if ((iSrcLen <= 0) || (iPatternLen < SUFFIX_SIZE) || (iPatternLen > iSrcLen))
+        return SearchTwoWay(pSrc, iSrcLen, pPattern, iPatternLen, nullptr, 0, 0, false);
+
+    size_t aShift[TWOWAY_HASH_SIZE];
+    size_t iSuffix, iPeriod;
+    bool bPeriodic;
+    ComputeTwoWayTables(pPattern, iPatternLen, aShift, &iSuffix, &iPeriod, &bPeriodic);
+    return SearchTwoWay(pSrc, iSrcLen, pPattern, iPatternLen, aShift, iSuffix, iPeriod, bPeriodic);
+}
+
+//--------------------------------------------------------------------------
+// The searchers work on elements of type T: bytes, or the 16/32/64-bit
+// words of the wide tables. A wide element is a better hash key than a byte
+// pair and every skip moves by whole elements, so the average shift in
+// bytes grows with the element size. The buffers need not be aligned.
+template <class T>
+static inline T GetElem(const BYTE *pData, ssize_t i)
+{
+    T v;
+    memcpy(&v, pData + i * (ssize_t) sizeof(T), sizeof(T));
+    return v;
+}
+
+static inline ssize_t HashPair(uchar a, uchar b)
+{
+    return ((((ssize_t) a) + ((ssize_t) b)) & (HASH_RANGE_MAX - 1));
+}
+
+// the wide elements are mixed, their low bits alone are often constant
+template <class T>
+static inline ssize_t HashPair(T a, T b)
 {
-    return ((((ssize_t) pData[-1]) + ((ssize_t) pData[0])) & (HASH_RANGE_MAX - 1));
+    uint64 h = ((uint64) a * 0x9E3779B97F4A7C15ULL) ^ (uint64) b;
+    h *= 0xC2B2AE3D27D4EB4FULL;
+    return (ssize_t) (h >> (64 - HASH_BITS));
 }
 
-static ssize_t SearchSmallpat(PBYTE pSrc, ssize_t iSrcLen, PBYTE pPattern, ssize_t iPatternLen)
+// hash of the elements i - 1 and i
+template <class T>
+static inline ssize_t Hash(const BYTE *pData, ssize_t i)
+{
+    return HashPair(GetElem<T>(pData, i - 1), GetElem<T>(pData, i));
+}
+
+template <class T>
+static ssize_t SearchSmallpat(const BYTE *pSrc, ssize_t iSrcLen, const BYTE *pPattern, ssize_t iPatternLen)
 {
     if ((0 == iSrcLen) || (0 == iPatternLen) || (iPatternLen > iSrcLen))
         return -1;
 
-    PBYTE pLimit = (pSrc + iSrcLen - iPatternLen);
-    for (PBYTE p = pSrc; p <= pLimit; p++)
+    const size_t iPatternSize = iPatternLen * sizeof(T);
+    const BYTE *pLimit = (pSrc + (iSrcLen - iPatternLen) * sizeof(T));
+    for (const BYTE *p = pSrc; p <= pLimit; p += sizeof(T))
     {
-        if (0 == memcmp(p, pPattern, iPatternLen))
-            return (p - pSrc);
+        COUNT_CANDIDATE();
+        if (0 == memcmp(p, pPattern, iPatternSize))
+            return (p - pSrc) / sizeof(T);
     }
 
     return -1;
 }
 
-static void ComputeBacktrackTable(PBYTE pPattern, ssize_t iPatternLen, ssize_t *piPatternBacktrack)
+template <>
+ssize_t SearchSmallpat<uchar>(const BYTE *pSrc, ssize_t iSrcLen, const BYTE *pPattern, ssize_t iPatternLen)
+{
+    return SearchShort(pSrc, iSrcLen, pPattern, iPatternLen);
+}
+
+template <class T>
+static void ComputeBacktrackTable(const BYTE *pPattern, ssize_t iPatternLen, ssize_t *piPatternBacktrack)
 {
     ssize_t j = 0, t = -1;
     piPatternBacktrack[j] = -1;
 
     while (j < iPatternLen - 1)
     {
-        while ((t >= 0) && (pPattern[j] != pPattern[t]))
+        while ((t >= 0) && (GetElem<T>(pPattern, j) != GetElem<T>(pPattern, t)))
         {
             t = piPatternBacktrack[t];
         }
 
         ++j, ++t;
-        piPatternBacktrack[j] = pPattern[j] == pPattern[t] ? piPatternBacktrack[t] : t;
+        piPatternBacktrack[j] = GetElem<T>(pPattern, j) == GetElem<T>(pPattern, t) ? piPatternBacktrack[t] : t;
     };
 }
 
-static ssize_t SearchHashed2(PBYTE pSrc, ssize_t iSrcLen, PBYTE pPattern, ssize_t iPatternLen, ssize_t *piPatternBacktrack)
-{
-    if ((iSrcLen <= 0) || (iPatternLen <= 0) || (iPatternLen > iSrcLen))
-        return -1;
-
-    if (iPatternLen < SUFFIX_SIZE)
-        return SearchSmallpat(pSrc, iSrcLen, pPattern, iPatternLen);
+// The skip table then the backtrack table of a pattern of at least
+// SUFFIX_SIZE elements, HASH_RANGE_MAX + iPatternLen entries in one block.
+// The skip of the last pair is SKIP_LARGE whatever the source length, so the
+// tables serve every search of the pattern. Returns the shift after a
+// mismatch on the first element
+#define HASHED2_TABLES_SIZE(len)    (HASH_RANGE_MAX + (len))
+#define SKIP_LARGE                  ((ssize_t) 1 << (sizeof(ssize_t) * 8 - 2))  // > any source length
 
-    ComputeBacktrackTable(pPattern, iPatternLen, piPatternBacktrack);
+template <class T>
+static ssize_t ComputeHashed2Tables(const BYTE *pPattern, ssize_t iPatternLen, ssize_t *pTables)
+{
+    ssize_t *aSkip = pTables;
+    ComputeBacktrackTable<T>(pPattern, iPatternLen, pTables + HASH_RANGE_MAX);
 
-    ssize_t aSkip[HASH_RANGE_MAX];
     for (ssize_t i = 0; i < HASH_RANGE_MAX; i++)
         aSkip[i] = iPatternLen - SUFFIX_SIZE + 1;
 
-    for (ssize_t i = 0; i < iPatternLen - 1; i++)
-        aSkip[Hash(pPattern + i)] = iPatternLen - 1 - i;
+    // Hash<T>(p, i) reads the elements i - 1 and i: the first pair ends at
+    // SUFFIX_SIZE - 1, starting at 0 read the element before the pattern
+    for (ssize_t i = SUFFIX_SIZE - 1; i < iPatternLen - 1; i++)
+        aSkip[Hash<T>(pPattern, i)] = iPatternLen - 1 - i;
+
+    ssize_t iMismatchShift = aSkip[Hash<T>(pPattern, iPatternLen - 1)];
+    aSkip[Hash<T>(pPattern, iPatternLen - 1)] = SKIP_LARGE;
+    return iMismatchShift;
+}
+
+// lengths and the result are in elements of T, pTables and iMismatchShift
+// from ComputeHashed2Tables
+template <class T>
+static ssize_t SearchHashed2(const BYTE *pSrc, ssize_t iSrcLen, const BYTE *pPattern, ssize_t iPatternLen,
+                             const ssize_t *pTables, ssize_t iMismatchShift)
+{
+    if ((iSrcLen <= 0) || (iPatternLen <= 0) || (iPatternLen > iSrcLen))
+        return -1;
+
+    if (iPatternLen < SUFFIX_SIZE)
+        return SearchSmallpat<T>(pSrc, iSrcLen, pPattern, iPatternLen);
 
-    ssize_t iLarge         = iSrcLen + 1;
-    ssize_t iMismatchShift = aSkip[Hash(pPattern + iPatternLen - 1)];
-    aSkip[Hash(pPattern + iPatternLen - 1)] = iLarge;
+    const ssize_t *aSkip = pTables;
+    const ssize_t *piPatternBacktrack = pTables + HASH_RANGE_MAX;
 
-    PBYTE pSrcEnd = pSrc + iSrcLen;
+    const BYTE *pSrcEnd = pSrc + iSrcLen * sizeof(T);
+    const T first = GetElem<T>(pPattern, 0);
     ssize_t k = -iSrcLen;
-    ssize_t iAdjustment = iLarge + iPatternLen - 1;
+    ssize_t iAdjustment = SKIP_LARGE + iPatternLen - 1;
 
     while (true)
     {
@@ -82,7 +501,7 @@ static ssize_t SearchHashed2(PBYTE pSrc, ssize_t iSrcLen, PBYTE pPattern, ssize_
 
         do
         {
-            k += aSkip[Hash(pSrcEnd + k)];
+            k += aSkip[Hash<T>(pSrcEnd, k)];
         }
         while (k < 0);
 
@@ -93,7 +512,8 @@ static ssize_t SearchHashed2(PBYTE pSrc, ssize_t iSrcLen, PBYTE pPattern, ssize_
 
         k -= iAdjustment;
 
-        if (pSrcEnd[k] != pPattern[0])
+        COUNT_CANDIDATE();
+        if (GetElem<T>(pSrcEnd, k) != first)
         {
             k += iMismatchShift;
             continue;
@@ -102,7 +522,7 @@ static ssize_t SearchHashed2(PBYTE pSrc, ssize_t iSrcLen, PBYTE pPattern, ssize_
         ssize_t i = 1;
         while (true)
         {
-            if (pSrcEnd[++k] != pPattern[i])
+            if (GetElem<T>(pSrcEnd, ++k) != GetElem<T>(pPattern, i))
             {
                 break;
             }
@@ -132,7 +552,9 @@ static ssize_t SearchHashed2(PBYTE pSrc, ssize_t iSrcLen, PBYTE pPattern, ssize_
                 break;
             }
 
-            while (pSrcEnd[k] == pPattern[i])
+            // the prefix of i elements still matches at the next alignment
+            COUNT_CANDIDATE();
+            while (GetElem<T>(pSrcEnd, k) == GetElem<T>(pPattern, i))
             {
                 k++;
                 if (++i == iPatternLen)
@@ -149,95 +571,1097 @@ static ssize_t SearchHashed2(PBYTE pSrc, ssize_t iSrcLen, PBYTE pPattern, ssize_
     }
 }
 
-static ssize_t *piPatternBacktrack = nullptr;
-static ssize_t iPatternBacktrackSize = 0;
+//--------------------------------------------------------------------------
+// Gapped multi-slice matcher
+//
+ssize_t gapped_matcher_t::add_pattern(const gapped_pattern_t &pat)
+{
+    if (pat.slices.empty())
+        return -1;
 
-// Clean up pattern search data
-void ClearPatternSearchData()
+    for (size_t i = 0; i < pat.slices.size(); i++)
+    {
+        const gap_slice_t &s = pat.slices[i];
+        if (s.bytes.empty() || s.min_gap > s.max_gap)
+            return -1;
+    }
+
+    patterns.push_back(pat);
+    compiled = false;
+    return patterns.size() - 1;
+}
+
+void gapped_matcher_t::clear()
+{
+    patterns.clear();
+    delta.clear();
+    outputs.clear();
+    compiled = false;
+}
+
+size_t gapped_matcher_t::max_match_len() const
 {
-    if (piPatternBacktrack)
+    size_t iMax = 0;
+    for (size_t i = 0; i < patterns.size(); i++)
     {
-        qfree(piPatternBacktrack);
-        piPatternBacktrack = nullptr;
-    };
-    iPatternBacktrackSize = 0;
+        const gapped_pattern_t &pat = patterns[i];
+        size_t iLen = 0;
+        for (size_t j = 0; j < pat.slices.size(); j++)
+        {
+            const gap_slice_t &s = pat.slices[j];
+            if (j > 0)
+            {
+                if (GAP_UNLIMITED == s.max_gap)
+                {
+                    iLen = GAP_UNLIMITED;
+                    break;
+                }
+                iLen += s.max_gap;
+            }
+            iLen += s.bytes.size();
+        }
+
+        if (0 != pat.max_span)
+            iLen = qmin(iLen, pat.max_span);
+
+        iMax = qmax(iMax, iLen);
+    }
+
+    return iMax;
 }
 
-// Search for pattern
-ssize_t PatternSearch(PBYTE pSrc, ssize_t iSrcLen, PBYTE pPattern, ssize_t iPatternLen, ssize_t iAnd)
+// Build the trie of all slices, then turn it into a full DFA (256 edges per node)
+bool gapped_matcher_t::compile()
 {
-    // Init backtrack buffer the first time
-    if (!piPatternBacktrack)
+    delta.clear();
+    outputs.clear();
+
+    delta.resize(256, -1);
+    outputs.push_back();
+
+    for (size_t i = 0; i < patterns.size(); i++)
     {
-        // Largest seen 7/9/2012 131072 bytes
-        iPatternBacktrackSize = qmax((iPatternLen * sizeof(ssize_t)), 131072);
-        piPatternBacktrack    = qalloc_array<ssize_t>(iPatternBacktrackSize);
-        if (!piPatternBacktrack)
+        const gapped_pattern_t &pat = patterns[i];
+        for (size_t j = 0; j < pat.slices.size(); j++)
         {
-            msg("** Failed to allocate pattern backtrace bufferr! **\n");
-            iPatternBacktrackSize = 0;
-            return -1;
+            const qvector<uchar> &bytes = pat.slices[j].bytes;
+            int32 iNode = 0;
+            for (size_t k = 0; k < bytes.size(); k++)
+            {
+                int32 &iNext = delta[iNode * 256 + bytes[k]];
+                if (iNext < 0)
+                {
+                    iNext = (int32) outputs.size();
+                    outputs.push_back();
+                    delta.resize(delta.size() + 256, -1);
+                }
+                iNode = delta[iNode * 256 + bytes[k]];
+            }
+
+            output_t out = { (uint32) i, (uint32) j };
+            outputs[iNode].push_back(out);
         }
     }
 
-    // Expand buffer as needed
-    ssize_t iNeeded = (iPatternLen * sizeof(ssize_t));
-    if (iNeeded > iPatternBacktrackSize)
+    // BFS over the trie, fail links are resolved into the goto table
+    qvector<int32> fail;
+    qvector<int32> queue;
+    fail.resize(outputs.size(), 0);
+    queue.reserve(outputs.size());
+
+    for (int c = 0; c < 256; c++)
     {
-        // msg("Expanding backtrace buffer from %d to %d bytes\n", iPatternBacktrackSize, iNeeded);
-        piPatternBacktrack = qrealloc_array<ssize_t>(piPatternBacktrack, iNeeded);
-        if (nullptr != piPatternBacktrack)
+        int32 &iNext = delta[c];
+        if (iNext < 0)
         {
-            iPatternBacktrackSize = iNeeded;
+            iNext = 0;
         }
         else
         {
-            msg("** Failed to expand pattern backtrace bufferr from %d to %d bytes! **\n",
-                iPatternBacktrackSize, iNeeded);
-            iPatternBacktrackSize = 0;
-            return -1;
+            fail[iNext] = 0;
+            queue.push_back(iNext);
         }
     }
 
-    ssize_t iGranularity = iAnd >> 3;
-    ssize_t iSlicesize   = iGranularity ? iGranularity : iPatternLen;
-    ssize_t iRemaining   = iSrcLen;
-    ssize_t iOfs         = -1;
-    ssize_t iMaxAndDistance = iPatternLen * 16;
-    PBYTE pPatLimit  = pPattern + iPatternLen;
-    PBYTE pPatStart  = nullptr;
-
-    for (PBYTE pStart = pSrc, p = pPattern; p < pPatLimit;)
+    for (size_t q = 0; q < queue.size(); q++)
     {
-        iOfs = SearchHashed2(pStart, iRemaining, p, iSlicesize, piPatternBacktrack);
-        if (iOfs != -1)
+        int32 iNode = queue[q];
+        int32 iFail = fail[iNode];
+
+        // slices ending at the fail node also end here
+        const qvector<output_t> &inherited = outputs[iFail];
+        for (size_t k = 0; k < inherited.size(); k++)
+            outputs[iNode].push_back(inherited[k]);
+
+        for (int c = 0; c < 256; c++)
         {
-            iRemaining -= (iOfs + iSlicesize);
-            if (!pPatStart)
+            int32 &iNext = delta[iNode * 256 + c];
+            if (iNext < 0)
             {
-                pPatStart = pStart + iOfs;
-                if (iRemaining > iMaxAndDistance)
-                {
-                    iRemaining = iMaxAndDistance;
-                }
+                iNext = delta[iFail * 256 + c];
+            }
+            else
+            {
+                fail[iNext] = delta[iFail * 256 + c];
+                queue.push_back(iNext);
             }
+        }
+    }
+
+    compiled = true;
+    return true;
+}
+
+#define NO_HIST             ((size_t) -1)
+#define HIST_COMPACT_MIN    4096    // history entries before the first compaction
+#define DEAD_PARTIAL        ((size_t) -1)   // next slice of a partial covered by a newer one
+
+bool gapped_matcher_t::first_less(const partial_t &a, const partial_t &b)
+{
+    return a.first < b.first;
+}
+
+// Drop partial matches whose next slice can no longer start in time.
+// iPos is the end offset of the current byte.
+void gapped_matcher_t::prune(qvector<partial_t> &active, const gapped_pattern_t &pat, size_t iPos)
+{
+    size_t n = 0;
+    for (size_t i = 0; i < active.size(); i++)
+    {
+        const partial_t &p = active[i];
+        if (DEAD_PARTIAL == p.next)
+            continue;
+
+        const gap_slice_t &s = pat.slices[p.next];
+        bool bAlive = true;
+
+        size_t iStart = iPos - s.bytes.size();
+        if (iPos >= s.bytes.size() && iStart > p.last_end && (iStart - p.last_end) > s.max_gap)
+            bAlive = false;
+
+        if (0 != pat.max_span && (iPos - p.first) > pat.max_span)
+            bAlive = false;
 
-            pStart += (iOfs + iSlicesize);
-            p      += iSlicesize;
+        if (bAlive)
+        {
+            if (n != i)
+                qswap(active[n], active[i]);
+            n++;
         }
-        else
+    }
+
+    active.resize(n);
+}
+
+// Add the partial matches that just matched the same slice, they all end
+// at the same offset. Partials with the same next slice and end have the
+// same future, with an unlimited gap before the next slice an earlier end
+// has it too. With a span limit the future also depends on the first
+// offset, which is then part of the key. Without one the earliest first
+// offset is kept
+void gapped_matcher_t::add_partials(qvector<partial_t> &active, const gapped_pattern_t &pat, qvector<partial_t> &fresh)
+{
+    if (fresh.empty())
+        return;
+
+    if (0 != pat.max_span)
+    {
+        std::sort(fresh.begin(), fresh.end(), first_less);
+        for (size_t i = 0; i < fresh.size(); i++)
         {
-            if (!pPatStart)
-            {
-                break;
-            }
+            if (0 == i || fresh[i].first != fresh[i - 1].first)
+                active.push_back(fresh[i]);
+        }
+        return;
+    }
+
+    size_t iBest = 0;
+    for (size_t i = 1; i < fresh.size(); i++)
+    {
+        if (fresh[i].first < fresh[iBest].first)
+            iBest = i;
+    }
+
+    const partial_t &p = fresh[iBest];
+    if (GAP_UNLIMITED == pat.slices[p.next].max_gap)
+    {
+        for (size_t i = 0; i < active.size(); i++)
+        {
+            if (active[i].next == p.next && active[i].first <= p.first)
+                return;
+        }
+    }
+
+    active.push_back(p);
+}
 
-            pStart = pPatStart + iSlicesize;
-            iRemaining = iSrcLen - (pStart - pSrc);
-            p = pPattern;
-            pPatStart = 0;
+// Drop the history entries no active partial reads. An entry always comes
+// after the previous one of its chain, so one pass renumbers them
+void gapped_matcher_t::compact_history(qvector<qvector<partial_t> > &active, qvector<hist_t> &history)
+{
+    qvector<size_t> remap;
+    remap.resize(history.size(), NO_HIST);
+    for (size_t i = 0; i < active.size(); i++)
+    {
+        for (size_t j = 0; j < active[i].size(); j++)
+        {
+            for (size_t h = active[i][j].hist; h != NO_HIST && 0 != remap[h]; h = history[h].prev)
+                remap[h] = 0;
         }
     }
 
-    return (iOfs != -1) ? (pPatStart - pSrc) : (ssize_t) -1;
+    size_t n = 0;
+    for (size_t h = 0; h < history.size(); h++)
+    {
+        if (NO_HIST == remap[h])
+            continue;
+
+        hist_t e = history[h];
+        if (NO_HIST != e.prev)
+            e.prev = remap[e.prev];
+        remap[h] = n;
+        history[n++] = e;
+    }
+    history.resize(n);
+
+    for (size_t i = 0; i < active.size(); i++)
+    {
+        for (size_t j = 0; j < active[i].size(); j++)
+            active[i][j].hist = remap[active[i][j].hist];
+    }
+}
+
+size_t gapped_matcher_t::scan(const uchar *pSrc, size_t iSrcLen, gapped_visitor_t &visitor)
+{
+    if (!compiled && !compile())
+        return 0;
+
+    qvector<qvector<partial_t> > active;
+    active.resize(patterns.size());
+
+    qvector<hist_t> history;
+    qvector<partial_t> fresh;
+    qvector<size_t> offsets;
+    size_t iCompactAt = HIST_COMPACT_MIN;
+    size_t iMatches = 0;
+    int32 iNode = 0;
+    for (size_t iPos = 0; iPos < iSrcLen; iPos++)
+    {
+        iNode = delta[iNode * 256 + pSrc[iPos]];
+        if (history.size() >= iCompactAt)
+        {
+            compact_history(active, history);
+            iCompactAt = qmax((size_t) HIST_COMPACT_MIN, 2 * history.size());
+        }
+
+        const qvector<output_t> &outs = outputs[iNode];
+        for (size_t k = 0; k < outs.size(); k++)
+        {
+            const gapped_pattern_t &pat = patterns[outs[k].pattern];
+            const size_t iSlice = outs[k].slice;
+            const size_t iEnd   = iPos + 1;
+            size_t iStart = iEnd - pat.slices[iSlice].bytes.size();
+
+            qvector<partial_t> &list = active[outs[k].pattern];
+            prune(list, pat, iEnd);
+
+            if (0 == iSlice)
+            {
+                if (1 == pat.slices.size())
+                {
+                    iMatches++;
+                    if (!visitor.visit(outs[k].pattern, pat, &iStart))
+                        return iMatches;
+                    continue;
+                }
+
+                partial_t p = { 1, iEnd, iStart, history.size() };
+                hist_t h = { iStart, NO_HIST };
+                history.push_back(h);
+                fresh.clear();
+                fresh.push_back(p);
+                add_partials(list, pat, fresh);
+                continue;
+            }
+
+            const gap_slice_t &s = pat.slices[iSlice];
+            const bool bLast = (iSlice + 1 == pat.slices.size());
+            const bool bUnlimited = !bLast && GAP_UNLIMITED == pat.slices[iSlice + 1].max_gap;
+            const size_t n = list.size();
+            qvector<size_t> done;
+            fresh.clear();
+            for (size_t i = 0; i < n; i++)
+            {
+                if (list[i].next != iSlice || iStart < list[i].last_end + s.min_gap)
+                    continue;
+
+                if ((iStart - list[i].last_end) > s.max_gap)
+                    continue;
+
+                if (0 != pat.max_span && (iEnd - list[i].first) > pat.max_span)
+                    continue;
+
+                // keep the old partial, a later hit of this slice may still
+                // be needed unless the next gap is unlimited
+                if (!bLast)
+                {
+                    partial_t p = { iSlice + 1, iEnd, list[i].first, history.size() };
+                    hist_t h = { iStart, list[i].hist };
+                    history.push_back(h);
+                    fresh.push_back(p);
+                    if (bUnlimited)
+                        list[i].next = DEAD_PARTIAL;
+                    continue;
+                }
+
+                // one match per start offset
+                if (done.has(list[i].first))
+                    continue;
+
+                done.push_back(list[i].first);
+                offsets.resize(pat.slices.size());
+                offsets[iSlice] = iStart;
+                size_t h = list[i].hist;
+                for (size_t j = iSlice; j-- > 0; h = history[h].prev)
+                    offsets[j] = history[h].start;
+
+                iMatches++;
+                if (!visitor.visit(outs[k].pattern, pat, offsets.begin()))
+                    return iMatches;
+            }
+
+            add_partials(list, pat, fresh);
+
+            if (!done.empty())
+            {
+                size_t m = 0;
+                for (size_t j = 0; j < list.size(); j++)
+                {
+                    if (!done.has(list[j].first))
+                    {
+                        if (m != j)
+                            qswap(list[m], list[j]);
+                        m++;
+                    }
+                }
+                list.resize(m);
+            }
+        }
+    }
+
+    return iMatches;
+}
+
+//--------------------------------------------------------------------------
+// Masked matcher
+//
+ssize_t masked_matcher_t::add_pattern(const masked_pattern_t &pat)
+{
+    if (pat.bytes.empty() || pat.bytes.size() != pat.mask.size())
+        return -1;
+
+    // longest run of fully masked bytes
+    size_t iBest = 0, iBestLen = 0;
+    for (size_t i = 0; i < pat.mask.size(); )
+    {
+        if (0xFF != pat.mask[i])
+        {
+            i++;
+            continue;
+        }
+
+        size_t j = i;
+        while (j < pat.mask.size() && 0xFF == pat.mask[j])
+            j++;
+
+        if (j - i > iBestLen)
+        {
+            iBest = i;
+            iBestLen = j - i;
+        }
+        i = j;
+    }
+
+    if (iBestLen < MATCHER_MASKED_ANCHOR_MIN)
+        return -1;
+
+    gapped_pattern_t anchor;
+    gap_slice_t &s = anchor.slices.push_back();
+    s.bytes.resize(iBestLen);
+    memcpy(s.bytes.begin(), pat.bytes.begin() + iBest, iBestLen);
+    s.min_gap = 0;
+    s.max_gap = 0;
+    anchors.add_pattern(anchor);
+
+    patterns.push_back(pat);
+    anchor_offsets.push_back(iBest);
+    return patterns.size() - 1;
+}
+
+void masked_matcher_t::clear()
+{
+    patterns.clear();
+    anchor_offsets.clear();
+    anchors.clear();
+}
+
+size_t masked_matcher_t::max_match_len() const
+{
+    size_t iMax = 0;
+    for (size_t i = 0; i < patterns.size(); i++)
+        iMax = qmax(iMax, patterns[i].bytes.size());
+    return iMax;
+}
+
+// verify the whole masked pattern around each anchor hit
+struct masked_bridge_t : public gapped_visitor_t
+{
+    const qvector<masked_pattern_t> &patterns;
+    const qvector<size_t> &anchor_offsets;
+    const uchar *pSrc;
+    size_t iSrcLen;
+    masked_visitor_t &visitor;
+    size_t iMatches;
+
+    masked_bridge_t(const qvector<masked_pattern_t> &_patterns, const qvector<size_t> &_anchor_offsets,
+                    const uchar *_pSrc, size_t _iSrcLen, masked_visitor_t &_visitor)
+        : patterns(_patterns), anchor_offsets(_anchor_offsets), pSrc(_pSrc), iSrcLen(_iSrcLen),
+          visitor(_visitor), iMatches(0) {}
+
+    virtual bool visit(size_t iPattern, const gapped_pattern_t &, const size_t *offsets)
+    {
+        const masked_pattern_t &pat = patterns[iPattern];
+        const size_t iAnchor = anchor_offsets[iPattern];
+        if (offsets[0] < iAnchor)
+            return true;
+
+        const size_t iStart = offsets[0] - iAnchor;
+        const size_t iLen = pat.bytes.size();
+        if (iStart + iLen > iSrcLen)
+            return true;
+
+        const uchar *pBytes = pat.bytes.begin();
+        const uchar *pMask = pat.mask.begin();
+        for (size_t i = 0; i < iLen; i++)
+        {
+            if ((pSrc[iStart + i] ^ pBytes[i]) & pMask[i])
+                return true;
+        }
+
+        iMatches++;
+        return visitor.visit(iPattern, pat, iStart);
+    }
+};
+
+size_t masked_matcher_t::scan(const uchar *pSrc, size_t iSrcLen, masked_visitor_t &visitor)
+{
+    masked_bridge_t bridge(patterns, anchor_offsets, pSrc, iSrcLen, visitor);
+    anchors.scan(pSrc, iSrcLen, bridge);
+    return bridge.iMatches;
+}
+
+//--------------------------------------------------------------------------
+// Wu-Manber matcher
+//
+static inline uint32 BlockAt(const uchar *p)
+{
+    return ((uint32) p[0] << 8) | p[1];
+}
+
+ssize_t wu_manber_t::add_pattern(const uchar *pPattern, size_t iPatternLen, const void *ud)
+{
+    if (iPatternLen < WM_BLOCK)
+        return -1;
+
+    qvector<uchar> &pat = patterns.push_back();
+    pat.resize(iPatternLen);
+    memcpy(pat.begin(), pPattern, iPatternLen);
+    uds.push_back(ud);
+    compiled = false;
+    return patterns.size() - 1;
+}
+
+void wu_manber_t::clear()
+{
+    patterns.clear();
+    uds.clear();
+    shift.clear();
+    bucket_start.clear();
+    entries.clear();
+    min_len = 0;
+    max_len = 0;
+    compiled = false;
+}
+
+bool wu_manber_t::compile()
+{
+    if (patterns.empty())
+        return false;
+
+    min_len = max_len = patterns[0].size();
+    for (size_t i = 1; i < patterns.size(); i++)
+    {
+        min_len = qmin(min_len, patterns[i].size());
+        max_len = qmax(max_len, patterns[i].size());
+    }
+
+    // the shift of a block is the distance from its end to the end of the
+    // prefixes, the default when it is in none of them
+    const uint32 m = (uint32) min_len;
+    shift.resize(WM_TABLE_SIZE);
+    for (size_t h = 0; h < WM_TABLE_SIZE; h++)
+        shift[h] = m - WM_BLOCK + 1;
+
+    bucket_start.resize(WM_TABLE_SIZE + 1);
+    memset(bucket_start.begin(), 0, bucket_start.size() * sizeof(uint32));
+    for (size_t i = 0; i < patterns.size(); i++)
+    {
+        const uchar *p = patterns[i].begin();
+        for (uint32 q = WM_BLOCK; q <= m; q++)
+        {
+            uint32 h = BlockAt(p + q - WM_BLOCK);
+            shift[h] = qmin(shift[h], m - q);
+        }
+        bucket_start[BlockAt(p + m - WM_BLOCK) + 1]++;
+    }
+
+    for (size_t h = 0; h < WM_TABLE_SIZE; h++)
+        bucket_start[h + 1] += bucket_start[h];
+
+    // the patterns of a bucket in the order they were added
+    qvector<uint32> next;
+    next.resize(WM_TABLE_SIZE);
+    memcpy(next.begin(), bucket_start.begin(), WM_TABLE_SIZE * sizeof(uint32));
+    entries.resize(patterns.size());
+    for (size_t i = 0; i < patterns.size(); i++)
+    {
+        const uchar *p = patterns[i].begin();
+        entry_t &e = entries[next[BlockAt(p + m - WM_BLOCK)]++];
+        e.pattern = (uint32) i;
+        e.prefix = BlockAt(p);
+    }
+
+    compiled = true;
+    return true;
+}
+
+size_t wu_manber_t::scan(const uchar *pSrc, size_t iSrcLen, wm_visitor_t &visitor)
+{
+    if (!compiled && !compile())
+        return 0;
+
+    if (iSrcLen < min_len)
+        return 0;
+
+    size_t iMatches = 0;
+    const uint32 *pShift = shift.begin();
+    for (size_t iPos = min_len - 1; iPos < iSrcLen; )
+    {
+        uint32 h = BlockAt(pSrc + iPos + 1 - WM_BLOCK);
+        uint32 s = pShift[h];
+        if (0 != s)
+        {
+            iPos += s;
+            continue;
+        }
+
+        const size_t iStart = iPos + 1 - min_len;
+        const uint32 prefix = BlockAt(pSrc + iStart);
+        for (uint32 i = bucket_start[h]; i < bucket_start[h + 1]; i++)
+        {
+            const entry_t &e = entries[i];
+            if (e.prefix != prefix)
+                continue;
+
+            const qvector<uchar> &pat = patterns[e.pattern];
+            if (iStart + pat.size() > iSrcLen || 0 != memcmp(pSrc + iStart, pat.begin(), pat.size()))
+                continue;
+
+            iMatches++;
+            if (!visitor.visit(e.pattern, iStart))
+                return iMatches;
+        }
+        iPos++;
+    }
+
+    return iMatches;
+}
+
+// Visitor for SearchSlices: keep the leftmost match
+struct leftmost_visitor_t : public gapped_visitor_t
+{
+    ssize_t iBest;
+
+    leftmost_visitor_t() : iBest(-1) {}
+
+    virtual bool visit(size_t, const gapped_pattern_t &, const size_t *offsets)
+    {
+        if (iBest < 0 || (ssize_t) offsets[0] < iBest)
+            iBest = offsets[0];
+        return true;
+    }
+};
+
+// AND mode of PatternSearch: slices of iSliceSize bytes in order, all
+// within iPatternLen * 16 bytes after the end of the first slice
+static void CompileSlices(gapped_matcher_t &matcher, const BYTE *pPattern, ssize_t iPatternLen, ssize_t iSliceSize)
+{
+    gapped_pattern_t pat;
+    pat.max_span = iSliceSize + (iPatternLen * 16);
+    for (ssize_t i = 0; i < iPatternLen; i += iSliceSize)
+    {
+        gap_slice_t &s = pat.slices.push_back();
+        s.bytes.resize(qmin(iSliceSize, iPatternLen - i));
+        memcpy(s.bytes.begin(), pPattern + i, s.bytes.size());
+        s.min_gap = 0;
+        s.max_gap = GAP_UNLIMITED;
+    }
+
+    matcher.clear();
+    matcher.add_pattern(pat);
+    matcher.compile();
+}
+
+static ssize_t SearchSlices(gapped_matcher_t &matcher, const BYTE *pSrc, ssize_t iSrcLen, ssize_t iPatternLen)
+{
+    if ((iSrcLen <= 0) || (iPatternLen <= 0) || (iPatternLen > iSrcLen))
+        return -1;
+
+    leftmost_visitor_t visitor;
+    matcher.scan(pSrc, iSrcLen, visitor);
+    return visitor.iBest;
+}
+
+void pattern_search_t::clear()
+{
+    tables.clear();
+    slices.clear();
+    slice_pattern.clear();
+    slice_size = 0;
+}
+
+// Search for pattern
+ssize_t pattern_search_t::search(const uchar *pSrc, ssize_t iSrcLen, const uchar *pPattern, ssize_t iPatternLen, ssize_t iAnd)
+{
+    ssize_t iGranularity = iAnd >> 3;
+    if (0 != iGranularity && iGranularity < iPatternLen)
+    {
+        // compiled again only for another pattern or slice size
+        if (iGranularity != slice_size || (size_t) iPatternLen != slice_pattern.size()
+         || 0 != memcmp(slice_pattern.begin(), pPattern, iPatternLen))
+        {
+            CompileSlices(slices, pPattern, iPatternLen, iGranularity);
+            slice_pattern.resize(iPatternLen);
+            memcpy(slice_pattern.begin(), pPattern, iPatternLen);
+            slice_size = iGranularity;
+        }
+        return SearchSlices(slices, pSrc, iSrcLen, iPatternLen);
+    }
+
+    if (iPatternLen <= SHORT_PATTERN_MAX)
+    {
+        return SearchShort(pSrc, iSrcLen, pPattern, iPatternLen);
+    }
+
+    if (iPatternLen >= LONG_PATTERN_MIN)
+    {
+        return SearchTwoWay(pSrc, iSrcLen, pPattern, iPatternLen);
+    }
+
+    return search_elements(pSrc, iSrcLen, pPattern, iPatternLen);
+}
+
+ssize_t pattern_search_t::search(const uchar *pSrc, ssize_t iSrcLen, const uint16 *pPattern, ssize_t iPatternCount)
+{
+    return search_elements(pSrc, iSrcLen, pPattern, iPatternCount);
+}
+
+ssize_t pattern_search_t::search(const uchar *pSrc, ssize_t iSrcLen, const uint32 *pPattern, ssize_t iPatternCount)
+{
+    return search_elements(pSrc, iSrcLen, pPattern, iPatternCount);
+}
+
+ssize_t pattern_search_t::search(const uchar *pSrc, ssize_t iSrcLen, const uint64 *pPattern, ssize_t iPatternCount)
+{
+    return search_elements(pSrc, iSrcLen, pPattern, iPatternCount);
+}
+
+template <class T>
+ssize_t pattern_search_t::search_elements(const uchar *pSrc, ssize_t iSrcLen, const T *pPattern, ssize_t iPatternCount)
+{
+    // the bytes after the last whole element are not searched
+    ssize_t iSrcCount = iSrcLen / (ssize_t) sizeof(T);
+    if ((iPatternCount <= 0) || (iPatternCount > iSrcCount))
+    {
+        return -1;
+    }
+
+    // the tables only grow, no allocation once they fit
+    if ((size_t) HASHED2_TABLES_SIZE(iPatternCount) > tables.size())
+    {
+        tables.resize(HASHED2_TABLES_SIZE(iPatternCount));
+    }
+
+    ssize_t iMismatchShift = 0;
+    if (iPatternCount >= SUFFIX_SIZE)
+    {
+        iMismatchShift = ComputeHashed2Tables<T>((const BYTE *) pPattern, iPatternCount, tables.begin());
+    }
+
+    ssize_t iPos = SearchHashed2<T>(pSrc, iSrcCount, (const BYTE *) pPattern, iPatternCount, tables.begin(), iMismatchShift);
+    return (iPos < 0) ? -1 : iPos * (ssize_t) sizeof(T);
+}
+
+//--------------------------------------------------------------------------
+// Compiled pattern
+//
+bool compiled_pattern_t::compile(const void *pPattern, ssize_t iPatternCount, size_t iElemSize)
+{
+    clear();
+    if (iPatternCount <= 0 || (1 != iElemSize && 2 != iElemSize && 4 != iElemSize && 8 != iElemSize))
+        return false;
+
+    elsize = iElemSize;
+    bytes.resize(iPatternCount * iElemSize);
+    memcpy(bytes.begin(), pPattern, bytes.size());
+
+    // the short byte patterns have no tables
+    const BYTE *p = bytes.begin();
+    if (iPatternCount < SUFFIX_SIZE || (1 == elsize && iPatternCount <= SHORT_PATTERN_MAX))
+        return true;
+
+    if (1 == elsize && iPatternCount >= LONG_PATTERN_MIN)
+    {
+        tables.resize(TWOWAY_HASH_SIZE);
+        ComputeTwoWayTables(p, iPatternCount, (size_t *) tables.begin(), &suffix, &period, &periodic);
+        return true;
+    }
+
+    tables.resize(HASHED2_TABLES_SIZE(iPatternCount));
+    switch (elsize)
+    {
+        case 1: mismatch_shift = ComputeHashed2Tables<uchar>(p, iPatternCount, tables.begin());  break;
+        case 2: mismatch_shift = ComputeHashed2Tables<uint16>(p, iPatternCount, tables.begin()); break;
+        case 4: mismatch_shift = ComputeHashed2Tables<uint32>(p, iPatternCount, tables.begin()); break;
+        case 8: mismatch_shift = ComputeHashed2Tables<uint64>(p, iPatternCount, tables.begin()); break;
+    }
+    return true;
+}
+
+void compiled_pattern_t::clear()
+{
+    bytes.clear();
+    tables.clear();
+    elsize = 0;
+    mismatch_shift = 0;
+    suffix = 0;
+    period = 0;
+    periodic = false;
+}
+
+ssize_t compiled_pattern_t::search(const uchar *pSrc, ssize_t iSrcLen) const
+{
+    const ssize_t iPatternLen = bytes.size();
+    switch (elsize)
+    {
+        case 1:
+            if (iPatternLen <= SHORT_PATTERN_MAX)
+                return SearchShort(pSrc, iSrcLen, bytes.begin(), iPatternLen);
+            if (iPatternLen >= LONG_PATTERN_MIN)
+                return SearchTwoWay(pSrc, iSrcLen, bytes.begin(), iPatternLen, (const size_t *) tables.begin(), suffix, period, periodic);
+            return search_elements<uchar>(pSrc, iSrcLen);
+        case 2:
+            return search_elements<uint16>(pSrc, iSrcLen);
+        case 4:
+            return search_elements<uint32>(pSrc, iSrcLen);
+        case 8:
+            return search_elements<uint64>(pSrc, iSrcLen);
+    }
+    return -1;
+}
+
+template <class T>
+ssize_t compiled_pattern_t::search_elements(const uchar *pSrc, ssize_t iSrcLen) const
+{
+    ssize_t iSrcCount = iSrcLen / (ssize_t) sizeof(T);
+    ssize_t iPatternCount = bytes.size() / sizeof(T);
+    ssize_t iPos = SearchHashed2<T>(pSrc, iSrcCount, bytes.begin(), iPatternCount, tables.begin(), mismatch_shift);
+    return (iPos < 0) ? -1 : iPos * (ssize_t) sizeof(T);
+}
+
+//--------------------------------------------------------------------------
+// Single masked pattern
+//
+static inline bool MaskedEqual(const BYTE *pSrc, const BYTE *pPattern, const BYTE *pMask, ssize_t iLen)
+{
+    for (ssize_t i = 0; i < iLen; i++)
+    {
+        if ((pSrc[i] ^ pPattern[i]) & pMask[i])
+            return false;
+    }
+    return true;
+}
+
+// Shift-And: bit i of the state is set when the first i + 1 pattern bytes
+// match the source bytes ending at the current one. Up to 64 bytes, the
+// 256 masks of the byte values from ComputeShiftAndMasks
+#define SHIFT_AND_MAX   64
+
+static void ComputeShiftAndMasks(const BYTE *pPattern, const BYTE *pMask, ssize_t iPatternLen, uint64 *aMasks)
+{
+    for (size_t c = 0; c < 256; c++)
+    {
+        uint64 iBits = 0;
+        for (ssize_t i = 0; i < iPatternLen; i++)
+        {
+            if (0 == ((c ^ pPattern[i]) & pMask[i]))
+                iBits |= (uint64) 1 << i;
+        }
+        aMasks[c] = iBits;
+    }
+}
+
+static ssize_t SearchShiftAnd(const BYTE *pSrc, ssize_t iSrcLen, const uint64 *aMasks, ssize_t iPatternLen)
+{
+    const uint64 iFound = (uint64) 1 << (iPatternLen - 1);
+    uint64 iState = 0;
+    for (ssize_t j = 0; j < iSrcLen; j++)
+    {
+        iState = ((iState << 1) | 1) & aMasks[pSrc[j]];
+        if (0 != (iState & iFound))
+            return j - iPatternLen + 1;
+    }
+
+    return -1;
+}
+
+// the longest run of exact bytes, its offset and *piAnchorLen
+static ssize_t FindMaskedAnchor(const BYTE *pMask, ssize_t iPatternLen, ssize_t *piAnchorLen)
+{
+    ssize_t iAnchor = 0, iAnchorLen = 0, iRun = 0;
+    for (ssize_t i = 0; i < iPatternLen; i++)
+    {
+        iRun = (0xFF == pMask[i]) ? iRun + 1 : 0;
+        if (iRun > iAnchorLen)
+        {
+            iAnchorLen = iRun;
+            iAnchor = i + 1 - iRun;
+        }
+    }
+
+    *piAnchorLen = iAnchorLen;
+    return iAnchor;
+}
+
+// the Shift-And search for the short patterns without a long exact run
+static inline bool UseShiftAnd(ssize_t iAnchorLen, ssize_t iPatternLen)
+{
+    return iAnchorLen < SEARCH_MASKED_ANCHOR_MIN && iPatternLen <= SHIFT_AND_MAX;
+}
+
+// the anchor of the pattern starting at j is at j + iAnchor, each hit of
+// the compiled anchor is verified. Without an anchor (empty), every offset
+static ssize_t SearchMaskedAnchor(const BYTE *pSrc, ssize_t iSrcLen, const BYTE *pPattern, const BYTE *pMask, ssize_t iPatternLen,
+                                  const compiled_pattern_t &anchor, ssize_t iAnchor)
+{
+    const ssize_t iLast = iSrcLen - iPatternLen;
+    if (0 == anchor.size())
+    {
+        for (ssize_t j = 0; j <= iLast; j++)
+        {
+            if (MaskedEqual(pSrc + j, pPattern, pMask, iPatternLen))
+                return j;
+        }
+        return -1;
+    }
+
+    const ssize_t iAnchorEnd = iLast + iAnchor + (ssize_t) anchor.size();
+    for (ssize_t iFrom = iAnchor; iFrom <= iLast + iAnchor; )
+    {
+        ssize_t iHit = anchor.search(pSrc + iFrom, iAnchorEnd - iFrom);
+        if (iHit < 0)
+            return -1;
+
+        ssize_t j = iFrom + iHit - iAnchor;
+        if (MaskedEqual(pSrc + j, pPattern, pMask, iPatternLen))
+            return j;
+
+        iFrom += iHit + 1;
+    }
+
+    return -1;
+}
+
+ssize_t pattern_search_t::search_masked(const uchar *pSrc, ssize_t iSrcLen, const uchar *pPattern, const uchar *pMask, ssize_t iPatternLen)
+{
+    if ((iSrcLen <= 0) || (iPatternLen <= 0) || (iPatternLen > iSrcLen))
+        return -1;
+
+    ssize_t iAnchorLen;
+    const ssize_t iAnchor = FindMaskedAnchor(pMask, iPatternLen, &iAnchorLen);
+    if (iAnchorLen == iPatternLen)
+        return search(pSrc, iSrcLen, pPattern, iPatternLen, 0);
+
+    if (UseShiftAnd(iAnchorLen, iPatternLen))
+    {
+        uint64 aMasks[256];
+        ComputeShiftAndMasks(pPattern, pMask, iPatternLen, aMasks);
+        return SearchShiftAnd(pSrc, iSrcLen, aMasks, iPatternLen);
+    }
+
+    // the anchor tables are built once for all the hits
+    compiled_pattern_t anchor;
+    if (0 != iAnchorLen)
+        anchor.compile(pPattern + iAnchor, iAnchorLen, 1);
+    return SearchMaskedAnchor(pSrc, iSrcLen, pPattern, pMask, iPatternLen, anchor, iAnchor);
+}
+
+//--------------------------------------------------------------------------
+// Streaming search
+//
+bool stream_search_t::start(const uchar *pPattern, const uchar *pMask, size_t iPatternLen, size_t iElemSize)
+{
+    bytes.clear();
+    mask.clear();
+    exact.clear();
+    shift_and.clear();
+    anchor.clear();
+    anchor_offset = 0;
+    elsize = 1;
+    reset();
+    if (0 == iPatternLen)
+        return false;
+
+    if (1 != iElemSize)
+    {
+        if (nullptr != pMask || 0 != iPatternLen % iElemSize)
+            return false;
+        if (!exact.compile(pPattern, iPatternLen / iElemSize, iElemSize))
+            return false;
+        bytes.resize(iPatternLen);
+        memcpy(bytes.begin(), pPattern, iPatternLen);
+        elsize = iElemSize;
+        return true;
+    }
+
+    bytes.resize(iPatternLen);
+    memcpy(bytes.begin(), pPattern, iPatternLen);
+
+    // the tables of search_masked, built once for the whole stream
+    ssize_t iAnchorLen = iPatternLen;
+    if (nullptr != pMask)
+        anchor_offset = FindMaskedAnchor(pMask, iPatternLen, &iAnchorLen);
+
+    if (iAnchorLen == (ssize_t) iPatternLen)
+    {
+        exact.compile(pPattern, iPatternLen, 1);
+        return true;
+    }
+
+    mask.resize(iPatternLen);
+    memcpy(mask.begin(), pMask, iPatternLen);
+    if (UseShiftAnd(iAnchorLen, iPatternLen))
+    {
+        shift_and.resize(256);
+        ComputeShiftAndMasks(pPattern, pMask, iPatternLen, shift_and.begin());
+    }
+    else if (0 != iAnchorLen)
+    {
+        anchor.compile(pPattern + anchor_offset, iAnchorLen, 1);
+    }
+    return true;
+}
+
+void stream_search_t::reset(uint64 iOrigin)
+{
+    tail.clear();
+    origin = iOrigin;
+    pos = 0;
+    stopped = false;
+}
+
+// report the matches starting before iLimit, iBase is the stream offset of pSrc
+bool stream_search_t::search(const uchar *pSrc, size_t iSrcLen, size_t iLimit, uint64 iBase, stream_visitor_t &visitor)
+{
+    // the first aligned offset, the wide search keeps the alignment of pSrc
+    size_t iOff = (size_t) ((elsize - (origin + iBase) % elsize) % elsize);
+    while (iOff < iLimit)
+    {
+        const uchar *p = pSrc + iOff;
+        const ssize_t n = iSrcLen - iOff;
+        ssize_t iPos;
+        if (mask.empty())
+            iPos = exact.search(p, n);
+        else if (!shift_and.empty())
+            iPos = SearchShiftAnd(p, n, shift_and.begin(), bytes.size());
+        else
+            iPos = SearchMaskedAnchor(p, n, bytes.begin(), mask.begin(), bytes.size(), anchor, anchor_offset);
+        if (iPos < 0 || iOff + iPos >= iLimit)
+            break;
+
+        if (!visitor.visit(iBase + iOff + iPos))
+        {
+            stopped = true;
+            return false;
+        }
+        iOff += iPos + elsize;
+    }
+    return true;
+}
+
+bool stream_search_t::feed(const uchar *pChunk, size_t iChunkLen, stream_visitor_t &visitor)
+{
+    if (stopped || bytes.empty())
+        return false;
+
+    if (0 == iChunkLen)
+        return true;
+
+    // a match starting in the tail ends in this chunk: the window holds the
+    // tail and at most iKeep bytes of the chunk
+    const size_t iKeep = bytes.size() - 1;
+    if (!tail.empty())
+    {
+        const size_t iHead = qmin(iKeep, iChunkLen);
+        window.resize(tail.size() + iHead);
+        memcpy(window.begin(), tail.begin(), tail.size());
+        memcpy(window.begin() + tail.size(), pChunk, iHead);
+        if (!search(window.begin(), window.size(), tail.size(), pos - tail.size(), visitor))
+            return false;
+    }
+
+    if (!search(pChunk, iChunkLen, iChunkLen, pos, visitor))
+        return false;
+
+    // keep the last iKeep bytes of the stream
+    if (iChunkLen >= iKeep)
+    {
+        tail.resize(iKeep);
+        if (0 != iKeep)
+            memcpy(tail.begin(), pChunk + iChunkLen - iKeep, iKeep);
+    }
+    else
+    {
+        const size_t iOld = qmin(tail.size(), iKeep - iChunkLen);
+        if (iOld != tail.size())
+            memmove(tail.begin(), tail.begin() + tail.size() - iOld, iOld);
+        tail.resize(iOld + iChunkLen);
+        memcpy(tail.begin() + iOld, pChunk, iChunkLen);
+    }
+
+    pos += iChunkLen;
+    return true;
+}
+
+static pattern_search_t shared_search;
+
+// Clean up pattern search data
+void ClearPatternSearchData()
+{
+    shared_search.clear();
+}
+
+ssize_t PatternSearch(PBYTE pSrc, ssize_t iSrcLen, PBYTE pPattern, ssize_t iPatternLen, ssize_t iAnd)
+{
+    return shared_search.search(pSrc, iSrcLen, pPattern, iPatternLen, iAnd);
 }
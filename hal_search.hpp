@@ -0,0 +1,361 @@
+#ifndef _HAL_SEARCH_HPP_
+#define _HAL_SEARCH_HPP_
+
+#pragma once
+
+#include <pro.h>
+
+//--------------------------------------------------------------------------
+// Gapped multi-slice patterns
+//
+// A gapped pattern is a list of byte slices that must appear in order.
+// Slice i (i > 0) must start between min_gap and max_gap bytes after the end
+// of slice i - 1. All slices of all patterns are compiled into one
+// Aho-Corasick automaton, so a buffer is scanned once for the whole set.
+
+#define GAP_UNLIMITED   ((size_t) -1)
+
+struct gap_slice_t
+{
+    qvector<uchar> bytes;
+    size_t min_gap;             // ignored for the first slice
+    size_t max_gap;             // GAP_UNLIMITED: no limit
+};
+
+struct gapped_pattern_t
+{
+    qvector<gap_slice_t> slices;
+    size_t max_span;            // max bytes from the first slice start to the last slice end, 0 = no limit
+    const void *ud;             // user data, e.g. the array_info_t of the pattern
+
+    gapped_pattern_t() : max_span(0), ud(nullptr) {}
+};
+
+// Called for every complete match. offsets[i] is the buffer offset of slice i.
+// Return false to stop the scan.
+struct gapped_visitor_t
+{
+    virtual ~gapped_visitor_t() {}
+    virtual bool visit(size_t iPattern, const gapped_pattern_t &pat, const size_t *offsets) = 0;
+};
+
+class gapped_matcher_t
+{
+public:
+    gapped_matcher_t() : compiled(false) {}
+
+    // returns the pattern index, or -1 if the pattern is empty
+    ssize_t add_pattern(const gapped_pattern_t &pat);
+    bool compile();
+    void clear();
+
+    // scan the buffer, returns the number of matches
+    size_t scan(const uchar *pSrc, size_t iSrcLen, gapped_visitor_t &visitor);
+
+    size_t size() const { return patterns.size(); }
+    const gapped_pattern_t &pattern(size_t i) const { return patterns[i]; }
+
+    // longest possible match, used as the overlap between chunks
+    // GAP_UNLIMITED if some pattern has no span limit and an unlimited gap
+    size_t max_match_len() const;
+
+private:
+    struct output_t
+    {
+        uint32 pattern;
+        uint32 slice;
+    };
+
+    // the offsets of a partial match are a chain of history entries, read
+    // back only when the match completes
+    struct hist_t
+    {
+        size_t start;           // offset of a slice
+        size_t prev;            // entry of the previous slice, NO_HIST for slice 0
+    };
+
+    struct partial_t
+    {
+        size_t next;            // index of the next expected slice
+        size_t last_end;        // end offset of the last matched slice
+        size_t first;           // offset of slice 0
+        size_t hist;            // entry of the last matched slice
+    };
+
+    void prune(qvector<partial_t> &active, const gapped_pattern_t &pat, size_t pos);
+    static bool first_less(const partial_t &a, const partial_t &b);
+    void add_partials(qvector<partial_t> &active, const gapped_pattern_t &pat, qvector<partial_t> &fresh);
+    void compact_history(qvector<qvector<partial_t> > &active, qvector<hist_t> &history);
+
+    qvector<gapped_pattern_t> patterns;
+    qvector<int32> delta;                   // node * 256 + byte -> node
+    qvector<qvector<output_t> > outputs;    // slices ending at node
+    bool compiled;
+};
+
+//--------------------------------------------------------------------------
+// Single pattern search, see hal_search.cpp
+// iAnd != 0: the pattern is split into (iAnd >> 3) bytes slices which must
+// appear in order within iPatternLen * 16 bytes after the first slice
+//
+// The byte patterns of up to 32 bytes are searched with SSE2/AVX2, those of
+// at least LONG_PATTERN_MIN bytes with Two-Way, the others with a hashed
+// skip table.
+//
+// The search context owns the scratch buffers: the backtrack table grows to
+// the longest pattern and is kept for the next searches, the matcher of the
+// slices is kept for the next searches of the same pattern. A context is used
+// by one thread at a time, the searches with distinct contexts can run at
+// once.
+#define LONG_PATTERN_MIN            2048
+#define SEARCH_MASKED_ANCHOR_MIN    4   // search_masked: exact bytes to search a pattern by its anchor, else Shift-And
+
+#ifdef HAL_SEARCH_STATS
+// positions compared with the whole pattern by the single pattern searches,
+// counted for the benchmark only
+extern size_t hal_search_candidates;
+#endif
+
+class pattern_search_t
+{
+public:
+    pattern_search_t() : slice_size(0) {}
+
+    // offset of the first match in pSrc, -1 if none
+    ssize_t search(const uchar *pSrc, ssize_t iSrcLen, const uchar *pPattern, ssize_t iPatternLen, ssize_t iAnd);
+
+    // a pattern of iPatternCount words in host byte order, compared and
+    // shifted word by word: only the offsets multiple of the word size from
+    // pSrc are matched. Byte offset of the first match, -1 if none
+    ssize_t search(const uchar *pSrc, ssize_t iSrcLen, const uint16 *pPattern, ssize_t iPatternCount);
+    ssize_t search(const uchar *pSrc, ssize_t iSrcLen, const uint32 *pPattern, ssize_t iPatternCount);
+    ssize_t search(const uchar *pSrc, ssize_t iSrcLen, const uint64 *pPattern, ssize_t iPatternCount);
+
+    // a pattern with a mask byte per pattern byte, only the bits set in the
+    // mask are compared: 0x00 is a wildcard byte, 0xF0/0x0F wildcard nibbles.
+    // Without wildcard bits this is the exact search. The patterns of up to
+    // 64 bytes without a long exact run are searched bit-parallel, the others
+    // by their longest exact run with the exact search, verified at each hit
+    ssize_t search_masked(const uchar *pSrc, ssize_t iSrcLen, const uchar *pPattern, const uchar *pMask, ssize_t iPatternLen);
+
+    // free the scratch buffers
+    void clear();
+
+private:
+    template <class T>
+    ssize_t search_elements(const uchar *pSrc, ssize_t iSrcLen, const T *pPattern, ssize_t iPatternCount);
+
+    qvector<ssize_t> tables;            // skip and backtrack tables of the last search
+    gapped_matcher_t slices;            // matcher of the last sliced pattern
+    qvector<uchar> slice_pattern;       // and its key
+    ssize_t slice_size;
+};
+
+//--------------------------------------------------------------------------
+// Compiled pattern
+//
+// The same searches with the tables of the pattern built once: the skip
+// and backtrack tables of the hashed search, or the pair shifts of Two-Way,
+// in one block. For a pattern searched in many chunks or again after each
+// hit. The pattern is copied, a compiled pattern is read-only during the
+// searches and may be shared by several threads.
+class compiled_pattern_t
+{
+public:
+    compiled_pattern_t() : elsize(0), mismatch_shift(0), suffix(0), period(0), periodic(false) {}
+
+    // iPatternCount elements of iElemSize bytes (1, 2, 4 or 8) in host byte
+    // order, the wide ones are matched at the multiples of their size.
+    // Returns false for an empty pattern or another element size
+    bool compile(const void *pPattern, ssize_t iPatternCount, size_t iElemSize);
+    void clear();
+
+    // byte offset of the first match in pSrc, -1 if none
+    ssize_t search(const uchar *pSrc, ssize_t iSrcLen) const;
+
+    // pattern length in bytes
+    size_t size() const { return bytes.size(); }
+
+private:
+    template <class T>
+    ssize_t search_elements(const uchar *pSrc, ssize_t iSrcLen) const;
+
+    qvector<uchar> bytes;
+    qvector<ssize_t> tables;            // skip + backtrack, or the Two-Way pair shifts
+    size_t elsize;
+    ssize_t mismatch_shift;             // hashed search
+    size_t suffix;                      // Two-Way factorization
+    size_t period;
+    bool periodic;
+};
+
+//--------------------------------------------------------------------------
+// Streaming search
+//
+// One pattern searched in a stream fed chunk by chunk, e.g. a memory image
+// larger than any buffer. The last iPatternLen - 1 bytes of the stream are
+// kept and searched again with the start of the next chunk: the matches
+// across the chunk boundaries are found, every match is reported once at
+// its offset in the stream. An exact pattern of wide elements is matched at
+// the aligned offsets only, with the skips of the wide element search.
+
+// Called for every match, by increasing offset. Return false to stop the stream.
+struct stream_visitor_t
+{
+    virtual ~stream_visitor_t() {}
+    virtual bool visit(uint64 iOffset) = 0;
+};
+
+class stream_search_t
+{
+public:
+    stream_search_t() : anchor_offset(0), elsize(1), origin(0), pos(0), stopped(false) {}
+
+    // pMask: nullptr, or a mask byte per pattern byte as for search_masked().
+    // iElemSize: 2, 4 or 8 for an exact pattern of elements of that size,
+    // else 1. The pattern is copied. Returns false for an empty pattern, or
+    // wide elements with a mask or a pattern length not a multiple of them
+    bool start(const uchar *pPattern, const uchar *pMask, size_t iPatternLen, size_t iElemSize = 1);
+
+    // the next bytes of the stream, returns false once the visitor stopped it
+    bool feed(const uchar *pChunk, size_t iChunkLen, stream_visitor_t &visitor);
+
+    // a new stream with the same pattern. iOrigin: address of the stream
+    // start, the wide elements are matched at the addresses multiple of
+    // their size
+    void reset(uint64 iOrigin = 0);
+
+    // bytes fed since the start of the stream
+    uint64 offset() const { return pos; }
+
+private:
+    bool search(const uchar *pSrc, size_t iSrcLen, size_t iLimit, uint64 iBase, stream_visitor_t &visitor);
+
+    qvector<uchar> bytes;
+    qvector<uchar> mask;                // empty: exact pattern
+    compiled_pattern_t exact;           // exact pattern, or a mask without wildcard bits
+    qvector<uint64> shift_and;          // masked: Shift-And masks of the byte values, or
+    compiled_pattern_t anchor;          // the longest exact run, empty if none
+    ssize_t anchor_offset;
+    size_t elsize;
+    uint64 origin;
+    qvector<uchar> tail;                // last bytes of the stream, shorter than the pattern
+    qvector<uchar> window;              // the tail and the start of the next chunk
+    uint64 pos;
+    bool stopped;
+};
+
+// same with a shared context, single-threaded callers only
+ssize_t PatternSearch(uchar *pSrc, ssize_t iSrcLen, uchar *pPattern, ssize_t iPatternLen, ssize_t iAnd);
+void ClearPatternSearchData();
+
+//--------------------------------------------------------------------------
+// Masked patterns
+//
+// Each byte of a masked pattern is compared on the bits set in its mask, a
+// zero mask is a wildcard byte. The longest run of fully masked bytes of
+// every pattern is its anchor: all anchors are compiled into one gapped
+// matcher and the whole pattern is verified at each anchor hit.
+
+#define MATCHER_MASKED_ANCHOR_MIN   2   // masked_matcher_t: exact bytes of an anchor, else the pattern is rejected
+
+struct masked_pattern_t
+{
+    qvector<uchar> bytes;
+    qvector<uchar> mask;        // same size as bytes
+    const void *ud;             // user data
+
+    masked_pattern_t() : ud(nullptr) {}
+};
+
+// Called for every match at buffer offset iOffset. Return false to stop the scan.
+struct masked_visitor_t
+{
+    virtual ~masked_visitor_t() {}
+    virtual bool visit(size_t iPattern, const masked_pattern_t &pat, size_t iOffset) = 0;
+};
+
+class masked_matcher_t
+{
+public:
+    // returns the pattern index, or -1 if the pattern has no anchor of
+    // MATCHER_MASKED_ANCHOR_MIN bytes
+    ssize_t add_pattern(const masked_pattern_t &pat);
+    bool compile() { return anchors.compile(); }
+    void clear();
+
+    // scan the buffer, returns the number of matches
+    size_t scan(const uchar *pSrc, size_t iSrcLen, masked_visitor_t &visitor);
+
+    size_t size() const { return patterns.size(); }
+    const masked_pattern_t &pattern(size_t i) const { return patterns[i]; }
+
+    // longest pattern, used as the overlap between chunks
+    size_t max_match_len() const;
+
+private:
+    qvector<masked_pattern_t> patterns;
+    qvector<size_t> anchor_offsets;     // offset of the anchor in each pattern
+    gapped_matcher_t anchors;
+};
+
+//--------------------------------------------------------------------------
+// Multiple patterns, Wu-Manber
+//
+// The skip table of SearchHashed2 shared by a whole set of patterns. The
+// patterns are cut to the length m of the shortest one and every block of
+// WM_BLOCK bytes of these prefixes gives the shift to the next possible end
+// of a prefix. At a zero shift, the patterns whose prefix ends with the
+// block are filtered on their first WM_BLOCK bytes, then compared. The
+// shifts are at most m - WM_BLOCK + 1: the patterns shorter than
+// WM_MIN_PATTERN are better searched alone with the short pattern search.
+
+#define WM_BLOCK        2
+#define WM_TABLE_SIZE   (1 << (8 * WM_BLOCK))
+#define WM_MIN_PATTERN  16
+
+// Called for every match at buffer offset iOffset. Return false to stop the scan.
+struct wm_visitor_t
+{
+    virtual ~wm_visitor_t() {}
+    virtual bool visit(size_t iPattern, size_t iOffset) = 0;
+};
+
+class wu_manber_t
+{
+public:
+    wu_manber_t() : min_len(0), max_len(0), compiled(false) {}
+
+    // returns the pattern index, or -1 if it is shorter than WM_BLOCK
+    ssize_t add_pattern(const uchar *pPattern, size_t iPatternLen, const void *ud);
+    bool compile();
+    void clear();
+
+    // scan the buffer, returns the number of matches
+    size_t scan(const uchar *pSrc, size_t iSrcLen, wm_visitor_t &visitor);
+
+    size_t size() const { return patterns.size(); }
+    const void *pattern_ud(size_t i) const { return uds[i]; }
+    size_t min_match_len() const { return min_len; }
+
+    // longest pattern, used as the overlap between chunks
+    size_t max_match_len() const { return max_len; }
+
+private:
+    struct entry_t
+    {
+        uint32 pattern;
+        uint32 prefix;          // first WM_BLOCK bytes
+    };
+
+    qvector<qvector<uchar> > patterns;
+    qvector<const void *> uds;
+    qvector<uint32> shift;              // block -> shift
+    qvector<uint32> bucket_start;       // block -> first entry, WM_TABLE_SIZE + 1 items
+    qvector<entry_t> entries;           // the patterns by the block ending their prefix
+    size_t min_len;
+    size_t max_len;
+    bool compiled;
+};
+
+#endif  // _HAL_SEARCH_HPP_
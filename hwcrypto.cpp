@@ -0,0 +1,381 @@
+// Hardware crypto instructions
+//
+// AES-NI, SHA-NI, pclmulqdq, crc32 and the ARMv8 crypto extension replace
+// the tables, so the constant scanners never see these implementations.
+// On x86/x64 all of them live in the 0F38/0F3A opcode maps: the candidates
+// are the "0F 38", "0F 3A" byte pairs and the VEX (C4) and EVEX (62)
+// prefixes selecting these maps, found 16 bytes at a time with SSE2. Only
+// the candidates are decoded, with the mandatory prefix, REX and the VEX/EVEX
+// fields. On AArch64 each aligned word is filtered on its top byte first.
+
+#include <pro.h>
+#include <ida.hpp>
+#include <idp.hpp>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define HW_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+#include "findcrypt3.hpp"
+
+#define HW_SLICE_SIZE       0x400000    // bytes scanned by one job
+#define HW_MAX_INSN_LEN     16
+
+// encodings of the x86 instructions
+#define HW_LEGACY       0x01
+#define HW_VEX          0x02
+#define HW_EVEX         0x04
+#define HW_ALL          (HW_LEGACY | HW_VEX | HW_EVEX)
+
+// mandatory prefix, as the pp field of VEX/EVEX
+#define PP_NONE         0
+#define PP_66           1
+#define PP_F3           2
+#define PP_F2           3
+
+struct hw_x86_insn_t
+{
+    hw_insn_t info;
+    uchar map;                  // 2: 0F38, 3: 0F3A
+    uchar opcode;
+    uchar pp;                   // PP_...
+    uchar forms;                // HW_...
+};
+
+struct hw_a64_insn_t
+{
+    hw_insn_t info;
+    uint32 mask;
+    uint32 value;
+};
+
+static const hw_x86_insn_t x86_insns[] =
+{
+    { { "aesimc",           "AES/Rijndael"  }, 2, 0xDB, PP_66,   HW_LEGACY | HW_VEX  },
+    { { "aesenc",           "AES/Rijndael"  }, 2, 0xDC, PP_66,   HW_ALL              },
+    { { "aesenclast",       "AES/Rijndael"  }, 2, 0xDD, PP_66,   HW_ALL              },
+    { { "aesdec",           "AES/Rijndael"  }, 2, 0xDE, PP_66,   HW_ALL              },
+    { { "aesdeclast",       "AES/Rijndael"  }, 2, 0xDF, PP_66,   HW_ALL              },
+    { { "aeskeygenassist",  "AES/Rijndael"  }, 3, 0xDF, PP_66,   HW_LEGACY | HW_VEX  },
+    { { "sha1nexte",        "SHA1"          }, 2, 0xC8, PP_NONE, HW_LEGACY           },
+    { { "sha1msg1",         "SHA1"          }, 2, 0xC9, PP_NONE, HW_LEGACY           },
+    { { "sha1msg2",         "SHA1"          }, 2, 0xCA, PP_NONE, HW_LEGACY           },
+    { { "sha1rnds4",        "SHA1"          }, 3, 0xCC, PP_NONE, HW_LEGACY           },
+    { { "sha256rnds2",      "SHA256"        }, 2, 0xCB, PP_NONE, HW_LEGACY           },
+    { { "sha256msg1",       "SHA256"        }, 2, 0xCC, PP_NONE, HW_LEGACY           },
+    { { "sha256msg2",       "SHA256"        }, 2, 0xCD, PP_NONE, HW_LEGACY           },
+    { { "vsha512rnds2",     "SHA512"        }, 2, 0xCB, PP_F2,   HW_VEX              },
+    { { "vsha512msg1",      "SHA512"        }, 2, 0xCC, PP_F2,   HW_VEX              },
+    { { "vsha512msg2",      "SHA512"        }, 2, 0xCD, PP_F2,   HW_VEX              },
+    { { "vsm3msg1",         "SM3"           }, 2, 0xDA, PP_NONE, HW_VEX              },
+    { { "vsm3msg2",         "SM3"           }, 2, 0xDA, PP_66,   HW_VEX              },
+    { { "vsm3rnds2",        "SM3"           }, 3, 0xDE, PP_66,   HW_VEX              },
+    { { "vsm4key4",         "SM4"           }, 2, 0xDA, PP_F3,   HW_VEX | HW_EVEX    },
+    { { "vsm4rnds4",        "SM4"           }, 2, 0xDA, PP_F2,   HW_VEX | HW_EVEX    },
+    { { "pclmulqdq",        "GHASH/CRC"     }, 3, 0x44, PP_66,   HW_ALL              },
+    { { "crc32",            "CRC32_C"       }, 2, 0xF0, PP_F2,   HW_LEGACY           },
+    { { "crc32",            "CRC32_C"       }, 2, 0xF1, PP_F2,   HW_LEGACY           },
+    { { "gf2p8mulb",        "GFNI"          }, 2, 0xCF, PP_66,   HW_ALL              },
+    { { "gf2p8affineqb",    "GFNI"          }, 3, 0xCE, PP_66,   HW_ALL              },
+    { { "gf2p8affineinvqb", "GFNI"          }, 3, 0xCF, PP_66,   HW_ALL              },
+};
+
+static const hw_a64_insn_t a64_insns[] =
+{
+    { { "aese",             "AES/Rijndael"  }, 0xFFFFFC00, 0x4E284800 },
+    { { "aesd",             "AES/Rijndael"  }, 0xFFFFFC00, 0x4E285800 },
+    { { "aesmc",            "AES/Rijndael"  }, 0xFFFFFC00, 0x4E286800 },
+    { { "aesimc",           "AES/Rijndael"  }, 0xFFFFFC00, 0x4E287800 },
+    { { "sha1c",            "SHA1"          }, 0xFFE0FC00, 0x5E000000 },
+    { { "sha1p",            "SHA1"          }, 0xFFE0FC00, 0x5E001000 },
+    { { "sha1m",            "SHA1"          }, 0xFFE0FC00, 0x5E002000 },
+    { { "sha1su0",          "SHA1"          }, 0xFFE0FC00, 0x5E003000 },
+    { { "sha1h",            "SHA1"          }, 0xFFFFFC00, 0x5E280800 },
+    { { "sha1su1",          "SHA1"          }, 0xFFFFFC00, 0x5E281800 },
+    { { "sha256h",          "SHA256"        }, 0xFFE0FC00, 0x5E004000 },
+    { { "sha256h2",         "SHA256"        }, 0xFFE0FC00, 0x5E005000 },
+    { { "sha256su1",        "SHA256"        }, 0xFFE0FC00, 0x5E006000 },
+    { { "sha256su0",        "SHA256"        }, 0xFFFFFC00, 0x5E282800 },
+    { { "sha512h",          "SHA512"        }, 0xFFE0FC00, 0xCE608000 },
+    { { "sha512h2",         "SHA512"        }, 0xFFE0FC00, 0xCE608400 },
+    { { "sha512su0",        "SHA512"        }, 0xFFFFFC00, 0xCEC08000 },
+    { { "sha512su1",        "SHA512"        }, 0xFFE0FC00, 0xCE608800 },
+    { { "pmull",            "GHASH/CRC"     }, 0xBFE0FC00, 0x0EE0E000 },    // 64-bit polynomials only
+    { { "crc32",            "CRC32"         }, 0x7FE0F000, 0x1AC04000 },
+    { { "crc32c",           "CRC32_C"       }, 0x7FE0F000, 0x1AC05000 },
+};
+
+// x86_insns index + 1 by [map - 2][pp][opcode], one table per encoding
+struct hw_tables_t
+{
+    uchar x86[3][2][4][256];    // legacy, VEX, EVEX
+    uchar a64_top[256];         // the top byte of some a64_insns value
+};
+
+struct hw_job_t
+{
+    seg_slice_t slice;
+    bool a64;
+    const hw_tables_t *tables;
+    hwhitvec_t hits;
+};
+DECLARE_TYPE_AS_MOVABLE(hw_job_t);
+
+//--------------------------------------------------------------------------
+static void build_tables(hw_tables_t &t)
+{
+    memset(&t, 0, sizeof(t));
+    for (size_t i = 0; i < qnumber(x86_insns); ++i)
+    {
+        const hw_x86_insn_t &x = x86_insns[i];
+        for (int form = 0; form < 3; ++form)
+        {
+            if (0 != (x.forms & (1 << form)))
+            {
+                t.x86[form][x.map - 2][x.pp][x.opcode] = (uchar) (i + 1);
+            }
+        }
+    }
+
+    for (size_t i = 0; i < qnumber(a64_insns); ++i)
+    {
+        t.a64_top[a64_insns[i].value >> 24] = 1;
+        if (0 == (a64_insns[i].mask & 0x80000000))
+        {
+            t.a64_top[(a64_insns[i].value >> 24) | 0x80] = 1;
+        }
+        if (0 == (a64_insns[i].mask & 0x40000000))
+        {
+            t.a64_top[(a64_insns[i].value >> 24) | 0x40] = 1;
+        }
+    }
+}
+
+static void add_hit(hw_job_t &job, size_t off, const hw_insn_t *insn)
+{
+    hw_hit_t &hit = job.hits.push_back();
+    hit.ea = job.slice.ea + off;
+    hit.insn = insn;
+}
+
+//--------------------------------------------------------------------------
+// decode the candidate at off: "0F 38/3A", C4 or 62
+static void check_x86(hw_job_t &job, size_t off, bool is64)
+{
+    const seg_slice_t &slice = job.slice;
+    const uchar *p = slice.buf + off;
+    if (off + 5 > slice.avail)
+    {
+        return;
+    }
+
+    int form, map, pp, opcode;
+    if (0x0F == p[0])
+    {
+        form = 0;
+        map = (0x38 == p[1]) ? 2 : 3;
+        opcode = p[2];
+
+        // REX, then the mandatory prefix. These bytes may also be the end
+        // of the previous instruction, so no prefix is tried too.
+        size_t start = off;
+        pp = PP_NONE;
+        if (is64 && start > 0 && (slice.buf[start - 1] & 0xF0) == 0x40)
+        {
+            start--;
+        }
+        if (start > 0)
+        {
+            switch (slice.buf[start - 1])
+            {
+                case 0x66: pp = PP_66; break;
+                case 0xF3: pp = PP_F3; break;
+                case 0xF2: pp = PP_F2; break;
+            }
+        }
+        if (PP_NONE != pp && 0 == job.tables->x86[0][map - 2][pp][opcode])
+        {
+            pp = PP_NONE;
+        }
+    }
+    else if (0xC4 == p[0])
+    {
+        // les/lds in 32-bit code unless the modrm is a register
+        if (!is64 && (p[1] & 0xC0) != 0xC0)
+        {
+            return;
+        }
+        form = 1;
+        map = p[1] & 0x1F;
+        pp = p[2] & 3;
+        opcode = p[3];
+    }
+    else
+    {
+        // bound in 32-bit code unless the modrm is a register
+        if ((!is64 && (p[1] & 0xC0) != 0xC0) || 0 == (p[2] & 0x04) || off + 6 > slice.avail)
+        {
+            return;
+        }
+        form = 2;
+        map = p[1] & 7;
+        pp = p[2] & 3;
+        opcode = p[4];
+    }
+
+    if (map < 2 || map > 3)
+    {
+        return;
+    }
+
+    int idx = job.tables->x86[form][map - 2][pp][opcode];
+    if (0 != idx)
+    {
+        add_hit(job, off, &x86_insns[idx - 1].info);
+    }
+}
+
+static void scan_x86(hw_job_t &job)
+{
+    const seg_slice_t &slice = job.slice;
+    const bool is64 = (2 == slice.bitness);
+    const size_t limit = qmin(slice.size + HW_MAX_INSN_LEN, slice.avail);
+
+    size_t off = 0;
+#ifdef HW_USE_SSE2
+    const __m128i v0F = _mm_set1_epi8(0x0F);
+    const __m128i v38 = _mm_set1_epi8(0x38);
+    const __m128i v3A = _mm_set1_epi8(0x3A);
+    const __m128i vC4 = _mm_set1_epi8((char) 0xC4);
+    const __m128i v62 = _mm_set1_epi8(0x62);
+    const __m128i v02 = _mm_set1_epi8(0x02);
+    const __m128i v1E = _mm_set1_epi8(0x1E);
+    const __m128i v0E = _mm_set1_epi8(0x0E);
+    for (; off + 17 <= limit && off < slice.size; off += 16)
+    {
+        __m128i x = _mm_loadu_si128((const __m128i *) (slice.buf + off));
+        __m128i y = _mm_loadu_si128((const __m128i *) (slice.buf + off + 1));
+
+        // 0F 38, 0F 3A | C4 with map 2/3 | 62 with map 2/3
+        __m128i legacy = _mm_and_si128(_mm_cmpeq_epi8(x, v0F),
+                                       _mm_or_si128(_mm_cmpeq_epi8(y, v38), _mm_cmpeq_epi8(y, v3A)));
+        __m128i vex = _mm_and_si128(_mm_cmpeq_epi8(x, vC4),
+                                    _mm_cmpeq_epi8(_mm_and_si128(y, v1E), v02));
+        __m128i evex = _mm_and_si128(_mm_cmpeq_epi8(x, v62),
+                                     _mm_cmpeq_epi8(_mm_and_si128(y, v0E), v02));
+        uint32 bits = _mm_movemask_epi8(_mm_or_si128(legacy, _mm_or_si128(vex, evex)));
+        while (0 != bits)
+        {
+            int k = 0;
+            while (0 == (bits & (1u << k)))
+            {
+                k++;
+            }
+            bits &= bits - 1;
+            check_x86(job, off + k, is64);
+        }
+    }
+#endif
+
+    for (; off < slice.size && off + 1 < limit; ++off)
+    {
+        const uchar *p = slice.buf + off;
+        if ((0x0F == p[0] && (0x38 == p[1] || 0x3A == p[1]))
+         || (0xC4 == p[0] && 0x02 == (p[1] & 0x1E))
+         || (0x62 == p[0] && 0x02 == (p[1] & 0x0E)))
+        {
+            check_x86(job, off, is64);
+        }
+    }
+}
+
+//--------------------------------------------------------------------------
+static void scan_a64(hw_job_t &job)
+{
+    const seg_slice_t &slice = job.slice;
+    const uchar *top = job.tables->a64_top;
+    for (size_t off = (4 - (size_t) (slice.ea & 3)) & 3; off + 4 <= slice.avail && off < slice.size; off += 4)
+    {
+        const uchar *p = slice.buf + off;
+        if (0 == top[p[3]])
+        {
+            continue;
+        }
+
+        uint32 w = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32) p[3] << 24);
+        for (size_t i = 0; i < qnumber(a64_insns); ++i)
+        {
+            if ((w & a64_insns[i].mask) == a64_insns[i].value)
+            {
+                add_hit(job, off, &a64_insns[i].info);
+                break;
+            }
+        }
+    }
+}
+
+static void idaapi hw_worker(void *ud, size_t idx)
+{
+    hw_job_t &job = ((hw_job_t *) ud)[idx];
+    if (job.a64)
+    {
+        scan_a64(job);
+    }
+    else
+    {
+        scan_x86(job);
+    }
+}
+
+//--------------------------------------------------------------------------
+// find the hardware crypto instructions in the code segments of the range.
+// On x86 the hits are at the 0F, C4 or 62 byte, after the prefixes. The hits
+// are not checked against the items of the database.
+// returns false if cancelled by the user
+bool collect_hw_crypto(ea_t ea1, ea_t ea2, hwhitvec_t &hits)
+{
+    hits.clear();
+    if (PLFM_386 != PH.id && PLFM_ARM != PH.id)
+    {
+        return true;
+    }
+
+    hw_tables_t tables;
+    build_tables(tables);
+
+    snapshotvec_t snapshots;
+    qvector<seg_slice_t> slices;
+    if (!snapshot_segments(ea1, ea2, HW_SLICE_SIZE, true, snapshots, slices))
+    {
+        return false;
+    }
+
+    qvector<hw_job_t> jobs;
+    for (size_t i = 0; i < slices.size(); ++i)
+    {
+        // AArch64 only, no crypto extension scan of A32/T32
+        if (PLFM_ARM == PH.id && 2 != slices[i].bitness)
+        {
+            continue;
+        }
+
+        hw_job_t &job = jobs.push_back();
+        job.slice = slices[i];
+        job.a64 = (PLFM_ARM == PH.id);
+        job.tables = &tables;
+    }
+
+    run_workers(hw_worker, jobs.begin(), jobs.size());
+
+    for (size_t i = 0; i < jobs.size(); ++i)
+    {
+        const hwhitvec_t &local = jobs[i].hits;
+        for (size_t j = 0; j < local.size(); ++j)
+        {
+            hits.push_back(local[j]);
+        }
+    }
+
+    return true;
+}
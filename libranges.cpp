@@ -0,0 +1,191 @@
+// Library regions
+//
+// Statically linked binaries carry the C runtime, libgcc2 and zlib. Their
+// tables are in consts.cpp and are found first by the table pass. The tables
+// of a library are grouped into instances. The data around an instance and
+// the functions reading its tables are the library region, skipped by the
+// expensive passes which follow. The functions of a library are linked
+// together: the neighbors of its functions, up to some alignment padding,
+// are taken too when nothing outside the library refers to them.
+
+#include <pro.h>
+#include <ida.hpp>
+#include <bytes.hpp>
+#include <funcs.hpp>
+#include <segment.hpp>
+#include <xref.hpp>
+
+#include "findcrypt3.hpp"
+
+#define LIB_DATA_MARGIN     0x400       // bytes of data kept around the library tables
+#define LIB_MAX_CODE_SPAN   0x80000     // max span of the functions of one library
+#define LIB_MAX_PADDING     0x40        // bytes between two linked functions
+
+static const char *const library_families[] =
+{
+    "VC CRT/UCRT Library",
+    "libgcc2",
+    "zlib",
+};
+
+//--------------------------------------------------------------------------
+static bool idaapi is_xref_target(flags_t flags, void *)
+{
+    return has_xref(flags);
+}
+
+// the first address in [ea, end) with a data xref to it, BADADDR if none
+ea_t find_dref_target(ea_t ea, ea_t end)
+{
+    for (; ea < end && ea != BADADDR; ea = next_that(ea, end, is_xref_target))
+    {
+        if (has_xref(get_flags(ea)) && BADADDR != get_first_dref_to(ea))
+        {
+            return ea;
+        }
+    }
+    return BADADDR;
+}
+
+// the functions reading the data in [start, end)
+static void add_user_functions(ea_t start, ea_t end, rangevec_t &funcs)
+{
+    for (ea_t ea = find_dref_target(start, end); ea != BADADDR; ea = find_dref_target(ea + 1, end))
+    {
+        for (ea_t from = get_first_dref_to(ea); from != BADADDR; from = get_next_dref_to(ea, from))
+        {
+            func_t *pfn = get_func(from);
+            if (nullptr == pfn)
+            {
+                continue;
+            }
+
+            size_t i;
+            for (i = 0; i < funcs.size() && funcs[i].start_ea != pfn->start_ea; ++i)
+            {
+            }
+            if (i == funcs.size())
+            {
+                funcs.push_back(range_t(pfn->start_ea, pfn->end_ea));
+            }
+        }
+    }
+}
+
+static bool in_ranges(ea_t ea, const rangevec_t &ranges)
+{
+    for (size_t i = 0; i < ranges.size(); ++i)
+    {
+        if (ranges[i].contains(ea))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// all the code and data references to the function come from the ranges
+// or from the function itself
+static bool is_referred_from(const func_t *pfn, const rangevec_t &ranges)
+{
+    for (ea_t from = get_first_cref_to(pfn->start_ea); from != BADADDR; from = get_next_cref_to(pfn->start_ea, from))
+    {
+        if (!pfn->contains(from) && !in_ranges(from, ranges))
+        {
+            return false;
+        }
+    }
+    for (ea_t from = get_first_dref_to(pfn->start_ea); from != BADADDR; from = get_next_dref_to(pfn->start_ea, from))
+    {
+        if (!pfn->contains(from) && !in_ranges(from, ranges))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// add the functions next to the code ranges which only the code refers to,
+// until none is added. A range grows up to LIB_MAX_CODE_SPAN
+static void add_library_neighbors(rangevec_t &code)
+{
+    for (bool grown = true; grown; )
+    {
+        grown = false;
+        normalize_ranges(code);
+        for (size_t i = 0; i < code.size(); ++i)
+        {
+            range_t &r = code[i];
+            for (func_t *pfn = get_next_func(r.end_ea - 1);
+                 nullptr != pfn && pfn->start_ea >= r.end_ea && pfn->start_ea - r.end_ea <= LIB_MAX_PADDING
+                 && pfn->end_ea - r.start_ea <= LIB_MAX_CODE_SPAN && is_referred_from(pfn, code);
+                 pfn = get_next_func(pfn->start_ea))
+            {
+                r.end_ea = pfn->end_ea;
+                grown = true;
+            }
+
+            for (func_t *pfn = get_prev_func(r.start_ea);
+                 nullptr != pfn && pfn->end_ea <= r.start_ea && r.start_ea - pfn->end_ea <= LIB_MAX_PADDING
+                 && r.end_ea - pfn->start_ea <= LIB_MAX_CODE_SPAN && is_referred_from(pfn, code);
+                 pfn = get_prev_func(pfn->start_ea))
+            {
+                r.start_ea = pfn->start_ea;
+                grown = true;
+            }
+        }
+    }
+}
+
+//--------------------------------------------------------------------------
+// the library regions of the matches of the table pass
+void get_library_ranges(const matchvec_t &matches, qvector<lib_range_t> &ranges)
+{
+    ranges.clear();
+
+    qvector<instance_t> instances;
+    qvector<size_t> order;
+    cluster_matches(matches, instances, order);
+
+    for (size_t f = 0; f < qnumber(library_families); ++f)
+    {
+        const char *family = library_families[f];
+        rangevec_t funcs;
+        for (size_t i = 0; i < instances.size(); ++i)
+        {
+            const instance_t &inst = instances[i];
+            if (!streq(inst.algorithm, family))
+            {
+                continue;
+            }
+
+            segment_t *seg = getseg(inst.start);
+            if (nullptr == seg)
+            {
+                continue;
+            }
+
+            lib_range_t &r = ranges.push_back();
+            r.range.start_ea = qmax(seg->start_ea, inst.start - qmin(inst.start, (ea_t) LIB_DATA_MARGIN));
+            r.range.end_ea = qmin(seg->end_ea, inst.end + LIB_DATA_MARGIN);
+            r.family = family;
+            r.code = false;
+
+            add_user_functions(inst.start, inst.end, funcs);
+        }
+
+        if (funcs.empty())
+        {
+            continue;
+        }
+
+        add_library_neighbors(funcs);
+        for (size_t i = 0; i < funcs.size(); ++i)
+        {
+            lib_range_t &r = ranges.push_back();
+            r.range = funcs[i];
+            r.family = family;
+            r.code = true;
+        }
+    }
+}
@@ -0,0 +1,61 @@
+#include <pro.h>
+#include <ida.hpp>
+#include <idp.hpp>
+
+#include "findcrypt3.hpp"
+
+// Instruction byte signatures of crypto inner loops
+// Each byte is compared on the bits of its mask: the register fields,
+// displacements and optional prefixes are wildcards.
+// Taken from the GCC -O2 output for x86 and x64
+
+// TEA, XTEA: (v << 4) and (v >> 5) of the round function, each shift on
+// its own copy of v. The anchor is the count of the first shift and the
+// mov after it, which GCC encodes 89 /r
+//      mov     r32, r32
+//      shl     r32, 4
+//      mov     r32, r32
+//      shr     r32, 5
+static const uchar TEA_shl4_shr5[]      = { 0x89, 0xC0, 0xC1, 0xE0, 0x04, 0x89, 0xC0, 0xC1, 0xE8, 0x05 };
+static const uchar TEA_shl4_shr5_mask[] = { 0xFD, 0xC0, 0xFF, 0xF8, 0xFF, 0xFF, 0xC0, 0xFF, 0xF8, 0xFF };
+
+static const uchar TEA_shr5_shl4[]      = { 0x89, 0xC0, 0xC1, 0xE8, 0x05, 0x89, 0xC0, 0xC1, 0xE0, 0x04 };
+static const uchar TEA_shr5_shl4_mask[] = { 0xFD, 0xC0, 0xFF, 0xF8, 0xFF, 0xFF, 0xC0, 0xFF, 0xF8, 0xFF };
+
+// same with the REX prefixes of r8d-r15d, REX.W clear. The shifts have
+// their operand in r/m, REX.B alone: the anchor is 41 C1 of the first one
+static const uchar TEA_shl4_shr5_x64[]      = { 0x40, 0x89, 0xC0, 0x41, 0xC1, 0xE0, 0x04, 0x40, 0x89, 0xC0, 0x41, 0xC1, 0xE8, 0x05 };
+static const uchar TEA_shl4_shr5_x64_mask[] = { 0xF8, 0xFD, 0xC0, 0xFF, 0xFF, 0xF8, 0xFF, 0xF8, 0xFD, 0xC0, 0xFF, 0xFF, 0xF8, 0xFF };
+
+static const uchar TEA_shr5_shl4_x64[]      = { 0x40, 0x89, 0xC0, 0x41, 0xC1, 0xE8, 0x05, 0x40, 0x89, 0xC0, 0x41, 0xC1, 0xE0, 0x04 };
+static const uchar TEA_shr5_shl4_x64_mask[] = { 0xF8, 0xFD, 0xC0, 0xFF, 0xFF, 0xF8, 0xFF, 0xF8, 0xFD, 0xC0, 0xFF, 0xFF, 0xF8, 0xFF };
+
+// TEA: sum after 32 rounds, 32 * 0x9E3779B9
+//      cmp     r32, 0C6EF3720h
+//      cmp     eax, 0C6EF3720h
+//      mov     r32, 0C6EF3720h         ; decryption
+static const uchar TEA_sum_32_rounds_cmp[]          = { 0x81, 0xF8, 0x20, 0x37, 0xEF, 0xC6 };
+static const uchar TEA_sum_32_rounds_cmp_mask[]     = { 0xFF, 0xF8, 0xFF, 0xFF, 0xFF, 0xFF };
+
+static const uchar TEA_sum_32_rounds_cmp_eax[]      = { 0x3D, 0x20, 0x37, 0xEF, 0xC6 };
+static const uchar TEA_sum_32_rounds_cmp_eax_mask[] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+
+static const uchar TEA_sum_32_rounds_mov[]          = { 0xB8, 0x20, 0x37, 0xEF, 0xC6 };
+static const uchar TEA_sum_32_rounds_mov_mask[]     = { 0xF8, 0xFF, 0xFF, 0xFF, 0xFF };
+
+//--------------------------------------------------------------------------
+// Final opcode consts
+//
+
+const opcode_info_t opcode_consts[] =
+{
+    { { ARR_OPC(TEA_shl4_shr5),                 "TEA/XTEA"              }, TEA_shl4_shr5_mask,              PLFM_386    },
+    { { ARR_OPC(TEA_shr5_shl4),                 "TEA/XTEA"              }, TEA_shr5_shl4_mask,              PLFM_386    },
+    { { ARR_OPC(TEA_shl4_shr5_x64),             "TEA/XTEA"              }, TEA_shl4_shr5_x64_mask,          PLFM_386    },
+    { { ARR_OPC(TEA_shr5_shl4_x64),             "TEA/XTEA"              }, TEA_shr5_shl4_x64_mask,          PLFM_386    },
+    { { ARR_OPC(TEA_sum_32_rounds_cmp),         "TEA"                   }, TEA_sum_32_rounds_cmp_mask,      PLFM_386    },
+    { { ARR_OPC(TEA_sum_32_rounds_cmp_eax),     "TEA"                   }, TEA_sum_32_rounds_cmp_eax_mask,  PLFM_386    },
+    { { ARR_OPC(TEA_sum_32_rounds_mov),         "TEA"                   }, TEA_sum_32_rounds_mov_mask,      PLFM_386    },
+
+    { { NULL, 0, 0, 0, NULL, NULL                                       }, NULL,                            0           },
+};
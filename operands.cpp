@@ -7,8 +7,8 @@
 static const word32 Adler32_BASE[] = { 65521 };
 
 // TEA
+// the alternative delta 0x61C88647 = -TEA_DELTA is found as a variant
 static const word32 TEA_DELTA[] = { 0x9E3779B9 };
-static const word32 TEA_ALTERNATIVE_DELTA[] = { 0x61C88647 };
 
 // HTC: https://en.wikipedia.org/wiki/Cyclic_redundancy_check
 //
@@ -144,7 +144,6 @@ const array_info_t operand_consts[] =
     { ARR_LE(Adler32_BASE),                     "Adler32"               },
 
     { ARR_LE(TEA_DELTA),                        "TEA"                   },
-    { ARR_LE(TEA_ALTERNATIVE_DELTA),            "TEA"                   },
 
     { ARR_LE(CRC32_Normal),                     "CRC32"                 },
     { ARR_LE(CRC32_Reversed),                   "CRC32"                 },
@@ -0,0 +1,762 @@
+// Scan the instruction operands for crypto constants
+
+#include <pro.h>
+#include <ida.hpp>
+#include <idp.hpp>
+#include <kernwin.hpp>
+#include <bytes.hpp>
+#include <segment.hpp>
+#include <ua.hpp>
+
+#include <algorithm>
+
+#include "findcrypt3.hpp"
+
+#define SPLIT_MAX_INSNS     8       // max instructions between the two halves of a 64-bit constant
+
+//--------------------------------------------------------------------------
+// ranges skipped by the scans of the snapshots and by collect_immediates(),
+// like the code and data of the libraries. Sorted and disjoint.
+static rangevec_t excluded_ranges;
+
+static bool range_less(const range_t &a, const range_t &b)
+{
+    return a.start_ea < b.start_ea;
+}
+
+static bool end_less(ea_t ea, const range_t &r)
+{
+    return ea < r.end_ea;
+}
+
+// sort and merge the ranges, the empty ones are removed
+void normalize_ranges(rangevec_t &ranges)
+{
+    std::sort(ranges.begin(), ranges.end(), range_less);
+
+    size_t n = 0;
+    for (size_t i = 0; i < ranges.size(); ++i)
+    {
+        const range_t &r = ranges[i];
+        if (r.start_ea >= r.end_ea)
+        {
+            continue;
+        }
+
+        if (n > 0 && ranges[n - 1].end_ea >= r.start_ea)
+        {
+            ranges[n - 1].end_ea = qmax(ranges[n - 1].end_ea, r.end_ea);
+        }
+        else
+        {
+            ranges[n++] = r;
+        }
+    }
+    ranges.resize(n);
+}
+
+void set_excluded_ranges(const rangevec_t &ranges)
+{
+    excluded_ranges = ranges;
+    normalize_ranges(excluded_ranges);
+}
+
+// append the parts of [start, end) which are not in the normalized excluded
+// ranges to out
+void subtract_ranges(ea_t start, ea_t end, const rangevec_t &excluded, rangevec_t &out)
+{
+    const range_t *p = std::upper_bound(excluded.begin(), excluded.end(), start, end_less);
+    while (start < end)
+    {
+        if (p == excluded.end() || p->start_ea >= end)
+        {
+            out.push_back(range_t(start, end));
+            break;
+        }
+
+        if (p->start_ea > start)
+        {
+            out.push_back(range_t(start, p->start_ea));
+        }
+        start = p->end_ea;
+        ++p;
+    }
+}
+
+void subtract_excluded(ea_t start, ea_t end, rangevec_t &out)
+{
+    subtract_ranges(start, end, excluded_ranges, out);
+}
+
+//--------------------------------------------------------------------------
+// seq numbers the instructions across the ranges
+static bool collect_range_immediates(ea_t ea1, ea_t ea2, immvec_t &refs, imm_filter_t *filter, uint32 *seq)
+{
+    insn_t insn;
+    for (ea_t ea = ea1; ea < ea2 && ea != BADADDR; ea = next_head(ea, ea2))
+    {
+        if (0 == (*seq % 0x4000))
+        {
+            show_addr(ea);
+            if (user_cancelled())
+            {
+                return false;
+            }
+        }
+
+        if (!is_code(get_flags(ea)) || decode_insn(&insn, ea) <= 0)
+        {
+            continue;
+        }
+
+        for (int n = 0; n < UA_MAXOP && insn.ops[n].type != o_void; ++n)
+        {
+            const op_t &op = insn.ops[n];
+            if (o_imm != op.type && o_displ != op.type)
+            {
+                continue;
+            }
+
+            uint64 value = (o_imm == op.type) ? op.value : op.addr;
+            if (nullptr != filter && !filter(value))
+            {
+                continue;
+            }
+
+            imm_ref_t &ref = refs.push_back();
+            ref.ea = ea;
+            ref.value = value;
+            ref.insn = *seq;
+            ref.n = (uchar) n;
+            ref.type = op.type;
+        }
+
+        ++*seq;
+    }
+
+    return true;
+}
+
+// collect the immediate operands of all instructions in the range, but not
+// in the excluded ranges
+// returns false if cancelled by the user
+bool collect_immediates(ea_t ea1, ea_t ea2, immvec_t &refs, imm_filter_t *filter)
+{
+    refs.clear();
+
+    rangevec_t ranges;
+    subtract_excluded(ea1, ea2, ranges);
+
+    uint32 seq = 0;
+    for (size_t i = 0; i < ranges.size(); ++i)
+    {
+        if (!collect_range_immediates(ranges[i].start_ea, ranges[i].end_ea, refs, filter, &seq))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+//--------------------------------------------------------------------------
+// read [start, end) of the segment and cut it into slices of about
+// slice_size bytes at the instruction heads known by IDA, so that a decoder
+// is in sync at the start of every slice. The slices point into snapshots.
+static void snapshot_range(const segment_t *seg, ea_t start, ea_t end, size_t slice_size,
+                           snapshotvec_t &snapshots, qvector<seg_slice_t> &slices)
+{
+    qvector<uchar> &mem = snapshots.push_back();
+    mem.resize(end - start);
+    ssize_t sizeRead = get_bytes(mem.begin(), end - start, start, GMB_READALL);
+    if (sizeRead <= 0)
+    {
+        snapshots.pop_back();
+        return;
+    }
+
+    qvector<size_t> cuts;
+    cuts.push_back(0);
+    for (size_t off = slice_size; off < (size_t) sizeRead; off += slice_size)
+    {
+        ea_t ea = start + off;
+        if (is_code(get_flags(ea)) || is_code(get_flags(get_item_head(ea))))
+        {
+            ea = get_item_head(ea);
+        }
+
+        if (ea - start > cuts.back())
+        {
+            cuts.push_back(ea - start);
+        }
+    }
+    cuts.push_back(sizeRead);
+
+    // the buffer of mem does not move when snapshots grows
+    for (size_t i = 0; i + 1 < cuts.size(); ++i)
+    {
+        seg_slice_t &slice = slices.push_back();
+        slice.buf = mem.begin() + cuts[i];
+        slice.size = cuts[i + 1] - cuts[i];
+        slice.avail = sizeRead - cuts[i];
+        slice.ea = start + cuts[i];
+        slice.bitness = seg->bitness;
+    }
+}
+
+// snapshot the segments in the range, without the excluded ranges
+// returns false if cancelled by the user
+bool snapshot_segments(ea_t ea1, ea_t ea2, size_t slice_size, bool code_only,
+                       snapshotvec_t &snapshots, qvector<seg_slice_t> &slices)
+{
+    snapshots.clear();
+    slices.clear();
+    for (int n = 0; n < get_segm_qty(); ++n)
+    {
+        segment_t *seg = getnseg(n);
+        if (nullptr == seg || SEG_XTRN == seg->type || SEG_BSS == seg->type)
+        {
+            continue;
+        }
+
+        if (code_only && SEG_CODE != seg->type && 0 == (seg->perm & SEGPERM_EXEC))
+        {
+            continue;
+        }
+
+        ea_t start = qmax(ea1, seg->start_ea);
+        ea_t end = qmin(ea2, seg->end_ea);
+        if (start >= end)
+        {
+            continue;
+        }
+
+        rangevec_t ranges;
+        subtract_excluded(start, end, ranges);
+        for (size_t i = 0; i < ranges.size(); ++i)
+        {
+            show_addr(ranges[i].start_ea);
+            if (user_cancelled())
+            {
+                return false;
+            }
+
+            snapshot_range(seg, ranges[i].start_ea, ranges[i].end_ea, slice_size, snapshots, slices);
+        }
+    }
+
+    return true;
+}
+
+//--------------------------------------------------------------------------
+// 32-bit halves of the 64-bit operand constants
+struct half_t
+{
+    uint32 value;
+    const variant_t *var;
+    bool hi;
+};
+DECLARE_TYPE_AS_MOVABLE(half_t);
+
+static bool half_less(const half_t &a, const half_t &b)
+{
+    return a.value < b.value;
+}
+
+// values like 0, 0x1B or 0xFFFFFFFF are in every program
+bool is_weak_value(uint64 v, size_t elsize)
+{
+    const uint64 mask = (8 == elsize) ? ~W64LIT(0) : W64LIT(0xFFFFFFFF);
+    v &= mask;
+    return (v & ~W64LIT(0xFF)) == 0 || ((v | 0xFF) & mask) == mask;
+}
+
+// all operand constants with their derived forms
+const variantvec_t &get_operand_variants()
+{
+    static variantvec_t variants;
+    static bool built = false;
+    if (!built)
+    {
+        built = true;
+        for (const array_info_t *ptr = operand_consts; ptr->size != 0; ++ptr)
+        {
+            expand_variants(ptr, variants);
+        }
+    }
+    return variants;
+}
+
+// the elements of the sparse arrays with their derived forms, probed in the
+// constants built by the RISC instruction pairs
+static const variantvec_t &get_sparse_element_variants()
+{
+    static variantvec_t variants;
+    static bool built = false;
+    if (!built)
+    {
+        built = true;
+        for (const array_info_t *ptr = sparse_consts; ptr->size != 0; ++ptr)
+        {
+            expand_variants(ptr, variants);
+        }
+    }
+    return variants;
+}
+
+static const qvector<half_t> &get_half_index()
+{
+    static qvector<half_t> halves;
+    static bool built = false;
+    if (built)
+    {
+        return halves;
+    }
+
+    built = true;
+    const variantvec_t &variants = get_operand_variants();
+    for (size_t i = 0; i < variants.size(); ++i)
+    {
+        const variant_t &var = variants[i];
+        if (8 != var.ai->elsize)
+        {
+            continue;
+        }
+
+        for (size_t j = 0; j < var.values.size(); ++j)
+        {
+            uint32 lo = (uint32) var.values[j];
+            uint32 hi = (uint32) (var.values[j] >> 32);
+            if (is_weak_value(lo, 4) || is_weak_value(hi, 4))
+            {
+                continue;
+            }
+
+            half_t h1 = { lo, &var, false };
+            half_t h2 = { hi, &var, true };
+            halves.push_back(h1);
+            halves.push_back(h2);
+        }
+    }
+
+    std::sort(halves.begin(), halves.end(), half_less);
+    return halves;
+}
+
+//--------------------------------------------------------------------------
+// pair the 32-bit halves of 64-bit constants found in close instructions:
+//      mov     [esp+10h], 85EBCA87h
+//      mov     [esp+14h], 9E3779B1h
+// refs must be sorted by address
+void match_split_immediates(const immvec_t &refs, matchvec_t &matches)
+{
+    struct pending_t
+    {
+        size_t ref;
+        const variant_t *var;
+        bool hi;
+    };
+
+    const qvector<half_t> &halves = get_half_index();
+    if (halves.empty())
+    {
+        return;
+    }
+
+    qvector<pending_t> window;
+    for (size_t i = 0; i < refs.size(); ++i)
+    {
+        const imm_ref_t &ref = refs[i];
+
+        // drop the halves which are too far behind
+        size_t n = 0;
+        for (size_t j = 0; j < window.size(); ++j)
+        {
+            if (refs[window[j].ref].insn + SPLIT_MAX_INSNS >= ref.insn)
+            {
+                window[n++] = window[j];
+            }
+        }
+        window.resize(n);
+
+        half_t key = { (uint32) ref.value, nullptr, false };
+        const half_t *p = std::lower_bound(halves.begin(), halves.end(), key, half_less);
+        const variant_t *paired = nullptr;
+        for (; p != halves.end() && p->value == key.value; ++p)
+        {
+            if (p->var == paired)
+            {
+                continue;
+            }
+
+            size_t j;
+            for (j = 0; j < window.size(); ++j)
+            {
+                const pending_t &w = window[j];
+                if (w.var == p->var && w.hi != p->hi && refs[w.ref].insn != ref.insn)
+                {
+                    break;
+                }
+            }
+
+            if (j == window.size())
+            {
+                pending_t w = { i, p->var, p->hi };
+                window.push_back(w);
+                continue;
+            }
+
+            const size_t other_ref = window[j].ref;
+            const imm_ref_t &other = refs[other_ref];
+            match_t &m = matches.push_back();
+            m.ea = qmin(other.ea, ref.ea);
+            m.ai = p->var->ai;
+            m.type = MATCH_SPLIT_IMM;
+            m.variant = p->var->type;
+            m.eas.push_back(p->hi ? other.ea : ref.ea);
+            m.eas.push_back(p->hi ? ref.ea : other.ea);
+
+            // each half is used once
+            paired = p->var;
+            n = 0;
+            for (size_t k = 0; k < window.size(); ++k)
+            {
+                if (window[k].var != paired || (window[k].ref != other_ref && window[k].ref != i))
+                {
+                    window[n++] = window[k];
+                }
+            }
+            window.resize(n);
+        }
+    }
+}
+
+//--------------------------------------------------------------------------
+// Perfect hash over the values of all operand constants (hash and displace)
+//
+// bucket = mix(key) % nbuckets, slot = mix(key + seed[bucket]) % nslots.
+// The seed of every bucket is chosen so that no two keys share a slot,
+// so a lookup is one probe and one compare. The table is built at run
+// time by prepare_operand_tables(), before the first scan.
+struct const_slot_t
+{
+    uint64 key;
+    uint32 first;                   // first entry with this key
+    uint32 count;                   // 0: empty slot
+};
+DECLARE_TYPE_AS_MOVABLE(const_slot_t);
+
+struct const_entry_t
+{
+    uint64 key;
+    const variant_t *var;
+};
+DECLARE_TYPE_AS_MOVABLE(const_entry_t);
+
+static bool entry_less(const const_entry_t &a, const const_entry_t &b)
+{
+    return a.key < b.key;
+}
+
+static inline uint64 mix64(uint64 x)
+{
+    x ^= x >> 33;
+    x *= W64LIT(0xFF51AFD7ED558CCD);
+    x ^= x >> 33;
+    x *= W64LIT(0xC4CEB9FE1A85EC53);
+    x ^= x >> 33;
+    return x;
+}
+
+class const_lookup_t
+{
+public:
+    bool build(const variantvec_t &variants);
+
+    // returns the entries with this key, or nullptr
+    const const_entry_t *find(uint64 key, size_t *count) const
+    {
+        if (slots.empty())
+        {
+            return nullptr;
+        }
+
+        uint64 h = mix64(key);
+        uint64 seed = seeds[h & (seeds.size() - 1)];
+        const const_slot_t &slot = slots[mix64(key + seed) & (slots.size() - 1)];
+        if (0 == slot.count || slot.key != key)
+        {
+            return nullptr;
+        }
+
+        *count = slot.count;
+        return &entries[slot.first];
+    }
+
+private:
+    bool place(const qvector<qvector<uint32> > &buckets, const qvector<uint32> &unique);
+
+    qvector<uint64> seeds;
+    qvector<const_slot_t> slots;
+    qvector<const_entry_t> entries;
+};
+
+bool const_lookup_t::build(const variantvec_t &variants)
+{
+    entries.clear();
+    for (size_t i = 0; i < variants.size(); ++i)
+    {
+        const variant_t &var = variants[i];
+        for (size_t j = 0; j < var.values.size(); ++j)
+        {
+            if (is_weak_value(var.values[j], var.ai->elsize))
+            {
+                continue;
+            }
+
+            const_entry_t e = { var.values[j], &var };
+            entries.push_back(e);
+        }
+    }
+
+    if (entries.empty())
+    {
+        return false;
+    }
+
+    std::stable_sort(entries.begin(), entries.end(), entry_less);
+
+    // index of the first entry of each distinct key
+    qvector<uint32> unique;
+    for (size_t i = 0; i < entries.size(); ++i)
+    {
+        if (0 == i || entries[i].key != entries[i - 1].key)
+        {
+            unique.push_back((uint32) i);
+        }
+    }
+
+    size_t nslots = 1;
+    while (nslots < unique.size() + unique.size() / 4)
+    {
+        nslots <<= 1;
+    }
+
+    size_t nbuckets = 1;
+    while (nbuckets * 4 < unique.size())
+    {
+        nbuckets <<= 1;
+    }
+
+    for (; nslots <= (unique.size() << 6); nslots <<= 1)
+    {
+        qvector<qvector<uint32> > buckets;
+        buckets.resize(nbuckets);
+        for (size_t i = 0; i < unique.size(); ++i)
+        {
+            uint64 h = mix64(entries[unique[i]].key);
+            buckets[h & (nbuckets - 1)].push_back((uint32) i);
+        }
+
+        seeds.clear();
+        seeds.resize(nbuckets, 0);
+        slots.clear();
+        slots.resize(nslots);
+        for (size_t i = 0; i < nslots; ++i)
+        {
+            slots[i].count = 0;
+        }
+
+        if (place(buckets, unique))
+        {
+            return true;
+        }
+    }
+
+    seeds.clear();
+    slots.clear();
+    return false;
+}
+
+// place the biggest buckets first, try seeds until all keys of the bucket fit
+bool const_lookup_t::place(const qvector<qvector<uint32> > &buckets, const qvector<uint32> &unique)
+{
+    qvector<uint32> order;
+    for (size_t i = 0; i < buckets.size(); ++i)
+    {
+        order.push_back((uint32) i);
+    }
+
+    struct bigger_t
+    {
+        const qvector<qvector<uint32> > &b;
+        bigger_t(const qvector<qvector<uint32> > &_b) : b(_b) {}
+        bool operator()(uint32 x, uint32 y) const { return b[x].size() > b[y].size(); }
+    };
+    std::sort(order.begin(), order.end(), bigger_t(buckets));
+
+    const size_t mask = slots.size() - 1;
+    qvector<size_t> taken;
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+        const qvector<uint32> &bucket = buckets[order[i]];
+        if (bucket.empty())
+        {
+            break;
+        }
+
+        uint64 seed;
+        for (seed = 1; seed < 0x10000; ++seed)
+        {
+            taken.clear();
+            size_t j;
+            for (j = 0; j < bucket.size(); ++j)
+            {
+                size_t s = mix64(entries[unique[bucket[j]]].key + seed) & mask;
+                if (0 != slots[s].count || taken.has(s))
+                {
+                    break;
+                }
+                taken.push_back(s);
+            }
+
+            if (j == bucket.size())
+            {
+                break;
+            }
+        }
+
+        if (seed == 0x10000)
+        {
+            return false;
+        }
+
+        seeds[order[i]] = seed;
+        for (size_t j = 0; j < bucket.size(); ++j)
+        {
+            uint32 first = unique[bucket[j]];
+            uint32 last = (bucket[j] + 1 < unique.size()) ? unique[bucket[j] + 1] : (uint32) entries.size();
+            const_slot_t &slot = slots[taken[j]];
+            slot.key = entries[first].key;
+            slot.first = first;
+            slot.count = last - first;
+        }
+    }
+
+    return true;
+}
+
+//--------------------------------------------------------------------------
+static const_lookup_t lookup;
+static const_lookup_t sparse_lookup;    // elements of sparse_consts
+
+// build all operand tables, call it before starting the worker threads
+void prepare_operand_tables()
+{
+    static bool built = false;
+    if (built)
+    {
+        return;
+    }
+
+    built = true;
+    if (!lookup.build(get_operand_variants()))
+    {
+        msg("[%s] - failed to build the operand constant lookup table\n", PLUGIN_NAME);
+    }
+    if (!sparse_lookup.build(get_sparse_element_variants()))
+    {
+        msg("[%s] - failed to build the sparse element lookup table\n", PLUGIN_NAME);
+    }
+    get_half_index();
+}
+
+// 32-bit values are sign extended in 64-bit operands
+static const const_entry_t *find_operand_value(const const_lookup_t &table, uint64 value, size_t *count)
+{
+    uint64 key = value;
+    if ((key >> 32) == 0xFFFFFFFF)
+    {
+        key &= 0xFFFFFFFF;
+    }
+
+    const const_entry_t *e = table.find(key, count);
+    if (nullptr == e && key != value)
+    {
+        e = table.find(value, count);
+    }
+    return e;
+}
+
+// is the value an operand constant or a half of a 64-bit one?
+bool is_operand_candidate(uint64 value)
+{
+    size_t count;
+    if (nullptr != find_operand_value(lookup, value, &count))
+    {
+        return true;
+    }
+
+    const qvector<half_t> &halves = get_half_index();
+    half_t key = { (uint32) value, nullptr, false };
+    const half_t *p = std::lower_bound(halves.begin(), halves.end(), key, half_less);
+    return p != halves.end() && p->value == key.value;
+}
+
+// same with the elements of the sparse arrays: the RISC processors build
+// the round constants in registers, like the SHA-256 K with movw/movt
+bool is_risc_operand_candidate(uint64 value)
+{
+    size_t count;
+    return is_operand_candidate(value) || nullptr != find_operand_value(sparse_lookup, value, &count);
+}
+
+// add a match for every operand constant of elsize bytes equal to the data
+// word at ea, thread safe once the tables are prepared
+void match_operand_value(ea_t ea, uint64 value, size_t elsize, int type, matchvec_t &matches)
+{
+    size_t count = 0;
+    const const_entry_t *e = lookup.find(value, &count);
+    for (size_t j = 0; nullptr != e && j < count; ++j)
+    {
+        if (e[j].var->ai->elsize != elsize)
+        {
+            continue;
+        }
+
+        match_t &m = matches.push_back();
+        m.ea = ea;
+        m.ai = e[j].var->ai;
+        m.type = type;
+        m.variant = e[j].var->type;
+        m.eas.push_back(ea);
+    }
+}
+
+//--------------------------------------------------------------------------
+// look up every immediate and displacement in the perfect hash, and in the
+// one of the sparse elements if with_sparse
+void match_operand_constants(const immvec_t &refs, matchvec_t &matches, bool with_sparse)
+{
+    prepare_operand_tables();
+
+    for (size_t i = 0; i < refs.size(); ++i)
+    {
+        const imm_ref_t &ref = refs[i];
+        for (int t = 0; t < (with_sparse ? 2 : 1); ++t)
+        {
+            size_t count = 0;
+            const const_entry_t *e = find_operand_value(0 == t ? lookup : sparse_lookup, ref.value, &count);
+            for (size_t j = 0; nullptr != e && j < count; ++j)
+            {
+                match_t &m = matches.push_back();
+                m.ea = ref.ea;
+                m.ai = e[j].var->ai;
+                m.type = MATCH_OPERAND;
+                m.variant = e[j].var->type;
+                m.n = ref.n;
+                m.eas.push_back(ref.ea);
+            }
+        }
+    }
+}
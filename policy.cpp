@@ -0,0 +1,140 @@
+// Scan policy of the segments
+//
+// Each segment is classified by its type, permissions and name. The policy
+// table gives the priority of each class and the engines run on it: the
+// read-only data holds most of the tables and is scanned first, the code
+// gets the instruction engines, the resources only the table pass, and the
+// uninitialized and external segments are skipped.
+// Edit policies[] to change the scan of a class
+
+#include <algorithm>
+
+#include <pro.h>
+#include <ida.hpp>
+#include <segment.hpp>
+
+#include "findcrypt3.hpp"
+
+struct scan_policy_t
+{
+    int segclass;                   // SEGCLASS_...
+    int priority;                   // lower first, < 0 skipped
+    uint32 engines;                 // ENG_...
+};
+
+static const scan_policy_t policies[] =
+{
+    { SEGCLASS_RODATA,      0,  ENG_ARRAY | ENG_SPARSE | ENG_POOL                                       },
+    { SEGCLASS_DATA,        1,  ENG_ARRAY | ENG_SPARSE | ENG_POOL                                       },
+    { SEGCLASS_CODE,        2,  ENG_ARRAY | ENG_SPARSE | ENG_POOL | ENG_OPERAND | ENG_OPCODE | ENG_HW | ENG_FUNCS },
+    { SEGCLASS_RESOURCE,    3,  ENG_ARRAY                                                               },
+    { SEGCLASS_OVERLAY,     4,  ENG_ARRAY                                                               },
+    { SEGCLASS_BSS,         -1, 0                                                                       },
+    { SEGCLASS_EXTERN,      -1, 0                                                                       },
+};
+
+static const char *const segclass_names[SEGCLASS_COUNT] =
+{
+    "code", "read-only data", "data", "bss", "resource", "overlay", "extern",
+};
+
+const char *get_segclass_name(int segclass)
+{
+    return (segclass >= 0 && segclass < SEGCLASS_COUNT) ? segclass_names[segclass] : "?";
+}
+
+//--------------------------------------------------------------------------
+static int get_segment_class(const segment_t *seg)
+{
+    if (SEG_XTRN == seg->type || SEG_IMP == seg->type)
+    {
+        return SEGCLASS_EXTERN;
+    }
+
+    if (SEG_BSS == seg->type)
+    {
+        return SEGCLASS_BSS;
+    }
+
+    qstring name;
+    get_segm_name(&name, seg);
+    if (streq(name.c_str(), ".rsrc") || streq(name.c_str(), "__resource"))
+    {
+        return SEGCLASS_RESOURCE;
+    }
+    if (stristr(name.c_str(), "overlay") != nullptr)
+    {
+        return SEGCLASS_OVERLAY;
+    }
+
+    if (SEG_CODE == seg->type || 0 != (seg->perm & SEGPERM_EXEC))
+    {
+        return SEGCLASS_CODE;
+    }
+
+    // without permissions, the usual names
+    if (0 == seg->perm)
+    {
+        if (streq(name.c_str(), ".rdata") || streq(name.c_str(), ".rodata") || streq(name.c_str(), "__const"))
+        {
+            return SEGCLASS_RODATA;
+        }
+        return SEGCLASS_DATA;
+    }
+
+    return (0 == (seg->perm & SEGPERM_WRITE)) ? SEGCLASS_RODATA : SEGCLASS_DATA;
+}
+
+static bool scan_range_less(const scan_range_t &a, const scan_range_t &b)
+{
+    return a.priority != b.priority ? a.priority < b.priority : a.range.start_ea < b.range.start_ea;
+}
+
+//--------------------------------------------------------------------------
+// the parts of the segments in the range with their policy, by priority and
+// address. skipped receives the bytes of the skipped segments
+void get_scan_plan(ea_t ea1, ea_t ea2, qvector<scan_range_t> &plan, asize_t *skipped)
+{
+    plan.clear();
+    *skipped = 0;
+    for (int n = 0; n < get_segm_qty(); ++n)
+    {
+        segment_t *seg = getnseg(n);
+        if (nullptr == seg)
+        {
+            continue;
+        }
+
+        ea_t start = qmax(ea1, seg->start_ea);
+        ea_t end = qmin(ea2, seg->end_ea);
+        if (start >= end)
+        {
+            continue;
+        }
+
+        int segclass = get_segment_class(seg);
+        const scan_policy_t *policy = nullptr;
+        for (size_t i = 0; i < qnumber(policies); ++i)
+        {
+            if (policies[i].segclass == segclass)
+            {
+                policy = &policies[i];
+                break;
+            }
+        }
+
+        if (nullptr == policy || policy->priority < 0 || 0 == policy->engines)
+        {
+            *skipped += end - start;
+            continue;
+        }
+
+        scan_range_t &r = plan.push_back();
+        r.range = range_t(start, end);
+        r.segclass = segclass;
+        r.priority = policy->priority;
+        r.engines = policy->engines;
+    }
+
+    std::sort(plan.begin(), plan.end(), scan_range_less);
+}
@@ -0,0 +1,217 @@
+// Scan the aligned data words for operand constants
+//
+// ARM and Thumb compilers load the 32/64-bit constants from literal pools in
+// the code segments, and the constants of configuration blocks are plain
+// words in the data segments: none of them are instruction operands.
+// Every aligned 4-byte word is folded to 16 bits and tested in a 8 KB bitmap
+// of all operand constant values (one L1 cache hit per word, four words per
+// SSE2 step), only the words passing the bitmap are looked up in the perfect
+// hash of opscan.cpp. The 8-byte aligned words are also probed as 64-bit
+// values.
+
+#include <pro.h>
+#include <ida.hpp>
+#include <idp.hpp>
+#include <kernwin.hpp>
+#include <bytes.hpp>
+
+#include <string.h>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define POOL_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+#include "findcrypt3.hpp"
+
+#define POOL_SLICE_SIZE     0x400000    // bytes scanned by one job
+#define POOL_BITMAP_BITS    0x10000
+
+struct pool_job_t
+{
+    seg_slice_t slice;
+    const uint32 *bitmap;
+    bool be;
+    matchvec_t matches;
+};
+DECLARE_TYPE_AS_MOVABLE(pool_job_t);
+
+//--------------------------------------------------------------------------
+static inline uint32 fold_word(uint32 v)
+{
+    return (v ^ (v >> 16)) & (POOL_BITMAP_BITS - 1);
+}
+
+static inline bool test_bit(const uint32 *bitmap, uint32 i)
+{
+    return ((bitmap[i >> 5] >> (i & 31)) & 1) != 0;
+}
+
+static inline void set_bit(qvector<uint32> &bitmap, uint32 i)
+{
+    bitmap[i >> 5] |= 1u << (i & 31);
+}
+
+static inline uint32 read_raw32(const uchar *p)
+{
+    uint32 v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32 bswap32(uint32 v)
+{
+    return (v >> 24) | ((v >> 8) & 0xFF00) | ((v << 8) & 0xFF0000) | (v << 24);
+}
+
+// the words are read in little endian order by the scan, the bitmap holds
+// the first 4 bytes in memory of each value as read by the scan
+static void build_bitmap(qvector<uint32> &bitmap, bool be)
+{
+    bitmap.resize(POOL_BITMAP_BITS / 32, 0);
+
+    const variantvec_t &variants = get_operand_variants();
+    for (size_t i = 0; i < variants.size(); ++i)
+    {
+        const variant_t &var = variants[i];
+        const size_t elsize = var.ai->elsize;
+        if (4 != elsize && 8 != elsize)
+        {
+            continue;
+        }
+
+        for (size_t j = 0; j < var.values.size(); ++j)
+        {
+            uint64 v = var.values[j];
+            if (is_weak_value(v, elsize))
+            {
+                continue;
+            }
+
+            uint32 first = (uint32) v;
+            if (be)
+            {
+                first = bswap32((8 == elsize) ? (uint32) (v >> 32) : (uint32) v);
+            }
+            set_bit(bitmap, fold_word(first));
+        }
+    }
+}
+
+//--------------------------------------------------------------------------
+// the word at off passed the bitmap, look it up
+static void probe_word(pool_job_t &job, size_t off, uint32 raw)
+{
+    const seg_slice_t &slice = job.slice;
+    const ea_t ea = slice.ea + off;
+
+    match_operand_value(ea, job.be ? bswap32(raw) : raw, 4, MATCH_POOL, job.matches);
+
+    if (0 == (ea & 7) && off + 8 <= slice.avail)
+    {
+        uint32 raw2 = read_raw32(slice.buf + off + 4);
+        uint64 v = job.be
+                 ? (((uint64) bswap32(raw) << 32) | bswap32(raw2))
+                 : (((uint64) raw2 << 32) | raw);
+        match_operand_value(ea, v, 8, MATCH_POOL, job.matches);
+    }
+}
+
+static void idaapi pool_worker(void *ud, size_t idx)
+{
+    pool_job_t &job = ((pool_job_t *) ud)[idx];
+    const seg_slice_t &slice = job.slice;
+    const uint32 *bitmap = job.bitmap;
+
+    size_t off = (4 - (size_t) (slice.ea & 3)) & 3;
+
+#ifdef POOL_USE_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i mask = _mm_set1_epi32(POOL_BITMAP_BITS - 1);
+    for (; off + 16 <= slice.size; off += 16)
+    {
+        __m128i x = _mm_loadu_si128((const __m128i *) (slice.buf + off));
+
+        // most of the data is zero filled
+        if (0xFFFF == _mm_movemask_epi8(_mm_cmpeq_epi8(x, zero)))
+        {
+            continue;
+        }
+
+        uint32 folded[4];
+        __m128i f = _mm_and_si128(_mm_xor_si128(x, _mm_srli_epi32(x, 16)), mask);
+        _mm_storeu_si128((__m128i *) folded, f);
+
+        if (!(test_bit(bitmap, folded[0]) | test_bit(bitmap, folded[1])
+            | test_bit(bitmap, folded[2]) | test_bit(bitmap, folded[3])))
+        {
+            continue;
+        }
+
+        for (int k = 0; k < 4; ++k)
+        {
+            if (test_bit(bitmap, folded[k]))
+            {
+                probe_word(job, off + k * 4, read_raw32(slice.buf + off + k * 4));
+            }
+        }
+    }
+#endif
+
+    for (; off < slice.size && off + 4 <= slice.avail; off += 4)
+    {
+        uint32 raw = read_raw32(slice.buf + off);
+        if (test_bit(bitmap, fold_word(raw)))
+        {
+            probe_word(job, off, raw);
+        }
+    }
+}
+
+//--------------------------------------------------------------------------
+// find the operand constants stored as aligned words in all segments of the
+// range. The words of instructions and of bigger items (the arrays found by
+// the array signatures, structures) are not reported.
+// returns false if cancelled by the user
+bool match_pool_constants(ea_t ea1, ea_t ea2, matchvec_t &matches)
+{
+    prepare_operand_tables();
+
+    qvector<uint32> bitmap;
+    build_bitmap(bitmap, inf.is_be());
+
+    snapshotvec_t snapshots;
+    qvector<seg_slice_t> slices;
+    if (!snapshot_segments(ea1, ea2, POOL_SLICE_SIZE, false, snapshots, slices))
+    {
+        return false;
+    }
+
+    qvector<pool_job_t> jobs;
+    for (size_t i = 0; i < slices.size(); ++i)
+    {
+        pool_job_t &job = jobs.push_back();
+        job.slice = slices[i];
+        job.bitmap = bitmap.begin();
+        job.be = inf.is_be();
+    }
+
+    run_workers(pool_worker, jobs.begin(), jobs.size());
+
+    for (size_t i = 0; i < jobs.size(); ++i)
+    {
+        const matchvec_t &local = jobs[i].matches;
+        for (size_t j = 0; j < local.size(); ++j)
+        {
+            const match_t &m = local[j];
+            ea_t head = get_item_head(m.ea);
+            if (is_code(get_flags(head)) || get_item_size(head) > m.ai->elsize)
+            {
+                continue;
+            }
+            matches.push_back(m);
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,451 @@
+// Constants built by instruction pairs on RISC processors
+//
+// A 32-bit constant does not fit in one RISC instruction, the compilers
+// build it in a register with a pair of instructions:
+//      ARM         movw r0, #0x79B9        movt r0, #0x9E37
+//      AArch64     movz w0, #0x79B9        movk w0, #0x9E37, lsl #16
+//      MIPS        lui  v0, 0x9E37         ori/addiu v0, v0, 0x79B9
+//      RISC-V      lui  a0, 0x9E378        addi/addiw a0, a0, -0x647
+// The raw instruction words of the code snapshots are matched against these
+// encodings only, the constant is rebuilt from both halves and probed like
+// an x86 immediate, and against the elements of the sparse arrays: the
+// SHA-256 and MD5 round constants are built this way. The constants loaded
+// by one of these instructions alone are probed too: movw, movz, movn, lui,
+// and ori/addiu/addi from the zero register. No other instruction is decoded.
+
+#include <pro.h>
+#include <ida.hpp>
+#include <idp.hpp>
+#include <ua.hpp>
+
+#include <algorithm>
+
+#include "findcrypt3.hpp"
+
+#define RISC_SLICE_SIZE     0x100000    // bytes decoded by one job
+#define RISC_MAX_DISTANCE   32          // max bytes between the two instructions of a pair
+
+#define ISA_NONE    0
+#define ISA_ARM     1       // A32 and T32
+#define ISA_ARM64   2
+#define ISA_MIPS    3
+#define ISA_RISCV   4
+
+// the registers holding the first half of a constant
+struct risc_regs_t
+{
+    uint64 value[32];
+    size_t first[32];               // offset of the first instruction, BADOFF if none
+    size_t last[32];                // offset of the last instruction which changed the value
+
+    static const size_t BADOFF = size_t(-1);
+
+    risc_regs_t()
+    {
+        for (int i = 0; i < 32; ++i)
+        {
+            first[i] = BADOFF;
+        }
+    }
+
+    void set(int reg, uint64 v, size_t off)
+    {
+        value[reg] = v;
+        first[reg] = off;
+        last[reg] = off;
+    }
+
+    bool get(int reg, size_t off, uint64 *v) const
+    {
+        if (BADOFF == first[reg] || off - last[reg] > RISC_MAX_DISTANCE)
+        {
+            return false;
+        }
+        *v = value[reg];
+        return true;
+    }
+};
+
+struct risc_job_t
+{
+    seg_slice_t slice;
+    int isa;
+    bool be;
+    imm_filter_t *filter;
+    immvec_t refs;                  // insn = offset in the slice / instruction unit
+    uint32 ninsns;
+};
+DECLARE_TYPE_AS_MOVABLE(risc_job_t);
+
+//--------------------------------------------------------------------------
+static inline uint32 read16(const uchar *p, bool be)
+{
+    return be ? ((p[0] << 8) | p[1]) : ((p[1] << 8) | p[0]);
+}
+
+static inline uint32 read32(const uchar *p, bool be)
+{
+    return be ? ((read16(p, true) << 16) | read16(p + 2, true))
+              : ((read16(p + 2, false) << 16) | read16(p, false));
+}
+
+static inline uint64 sext(uint64 v, int bits)
+{
+    const uint64 sign = W64LIT(1) << (bits - 1);
+    return (v ^ sign) - sign;
+}
+
+// n: operand number of the immediate in the instruction at first
+static void add_ref(risc_job_t &job, size_t first, uint64 value, int unit, int n)
+{
+    if (nullptr != job.filter && !job.filter(value))
+    {
+        return;
+    }
+
+    imm_ref_t &ref = job.refs.push_back();
+    ref.ea = job.slice.ea + first;
+    ref.value = value;
+    ref.insn = (uint32) (first / unit);
+    ref.n = (uchar) n;
+    ref.type = o_imm;
+}
+
+// the pairs may end a bit after the slice, the first half must be in it
+static size_t get_limit(const seg_slice_t &slice)
+{
+    return qmin(slice.size + RISC_MAX_DISTANCE, slice.avail);
+}
+
+// first offset of the slice aligned on the instruction size
+static size_t get_aligned_start(const seg_slice_t &slice, size_t align)
+{
+    return (align - (size_t) (slice.ea % align)) % align;
+}
+
+//--------------------------------------------------------------------------
+// movw/movt in A32 and T32 code, the slices hold both
+static void decode_arm(risc_job_t &job)
+{
+    const seg_slice_t &slice = job.slice;
+    const size_t limit = get_limit(slice);
+
+    risc_regs_t a32;
+    for (size_t off = get_aligned_start(slice, 4); off + 4 <= limit; off += 4)
+    {
+        uint32 w = read32(slice.buf + off, job.be);
+        if ((w >> 28) == 0xF)
+        {
+            continue;
+        }
+
+        int rd = (w >> 12) & 0xF;
+        uint32 imm = ((w >> 4) & 0xF000) | (w & 0xFFF);
+        uint64 v;
+        if ((w & 0x0FF00000) == 0x03000000 && off < slice.size)
+        {
+            a32.set(rd, imm, off);
+            add_ref(job, off, imm, 2, 1);
+        }
+        else if ((w & 0x0FF00000) == 0x03400000 && a32.get(rd, off, &v))
+        {
+            add_ref(job, a32.first[rd], (v & 0xFFFF) | (imm << 16), 2, 1);
+        }
+    }
+
+    risc_regs_t t32;
+    for (size_t off = get_aligned_start(slice, 2); off + 2 <= limit; )
+    {
+        uint32 hw1 = read16(slice.buf + off, job.be);
+        if ((hw1 >> 11) < 0x1D)
+        {
+            off += 2;
+            continue;
+        }
+
+        if (off + 4 > limit)
+        {
+            break;
+        }
+
+        uint32 hw2 = read16(slice.buf + off + 2, job.be);
+        if ((hw2 & 0x8000) == 0)
+        {
+            int rd = (hw2 >> 8) & 0xF;
+            uint32 imm = ((hw1 & 0xF) << 12) | (((hw1 >> 10) & 1) << 11)
+                       | (((hw2 >> 12) & 7) << 8) | (hw2 & 0xFF);
+            uint64 v;
+            if ((hw1 & 0xFBF0) == 0xF240 && off < slice.size)
+            {
+                t32.set(rd, imm, off);
+                add_ref(job, off, imm, 2, 1);
+            }
+            else if ((hw1 & 0xFBF0) == 0xF2C0 && t32.get(rd, off, &v))
+            {
+                add_ref(job, t32.first[rd], (v & 0xFFFF) | (imm << 16), 2, 1);
+            }
+        }
+        off += 4;
+    }
+}
+
+//--------------------------------------------------------------------------
+// movz/movn, then each movk gives a value
+static void decode_arm64(risc_job_t &job)
+{
+    const seg_slice_t &slice = job.slice;
+    const size_t limit = get_limit(slice);
+
+    risc_regs_t regs;
+    for (size_t off = get_aligned_start(slice, 4); off + 4 <= limit; off += 4)
+    {
+        uint32 w = read32(slice.buf + off, false);
+        uint32 op = w & 0x7F800000;
+        if (0x52800000 != op && 0x12800000 != op && 0x72800000 != op)
+        {
+            continue;
+        }
+
+        bool sf = (w >> 31) != 0;
+        int hw = (w >> 21) & 3;
+        if (!sf && hw > 1)
+        {
+            continue;
+        }
+
+        const uint64 mask = sf ? ~W64LIT(0) : W64LIT(0xFFFFFFFF);
+        const int shift = hw * 16;
+        const uint64 imm = (uint64) ((w >> 5) & 0xFFFF) << shift;
+        int rd = w & 31;
+        uint64 v;
+        if (0x52800000 == op && off < slice.size)
+        {
+            regs.set(rd, imm, off);
+            add_ref(job, off, imm, 4, 1);
+        }
+        else if (0x12800000 == op && off < slice.size)
+        {
+            regs.set(rd, ~imm & mask, off);
+            add_ref(job, off, ~imm & mask, 4, 1);
+        }
+        else if (0x72800000 == op && regs.get(rd, off, &v))
+        {
+            v = ((v & ~(W64LIT(0xFFFF) << shift)) | imm) & mask;
+            regs.value[rd] = v;
+            regs.last[rd] = off;
+            add_ref(job, regs.first[rd], v, 4, 1);
+        }
+    }
+}
+
+//--------------------------------------------------------------------------
+// lui, ori/addiu/daddiu from $zero, and lui followed by ori, addiu or
+// daddiu reading the same register
+static void decode_mips(risc_job_t &job)
+{
+    const seg_slice_t &slice = job.slice;
+    const size_t limit = get_limit(slice);
+
+    risc_regs_t regs;
+    for (size_t off = get_aligned_start(slice, 4); off + 4 <= limit; off += 4)
+    {
+        uint32 w = read32(slice.buf + off, job.be);
+        uint32 op = w >> 26;
+        int rs = (w >> 21) & 31;
+        int rt = (w >> 16) & 31;
+        uint32 imm = w & 0xFFFF;
+        uint64 v;
+        if (0x0F == op)
+        {
+            if (0 == rs && off < slice.size)
+            {
+                regs.set(rt, imm << 16, off);
+                add_ref(job, off, imm << 16, 4, 1);
+            }
+        }
+        else if (0 == rs && (0x0D == op || 0x09 == op || 0x19 == op))
+        {
+            if (0 != rt && off < slice.size)
+            {
+                add_ref(job, off, (0x0D == op) ? imm : sext(imm, 16) & 0xFFFFFFFF, 4, 2);
+            }
+        }
+        else if (0x0D == op && regs.get(rs, off, &v))
+        {
+            add_ref(job, regs.first[rs], v | imm, 4, 1);
+        }
+        else if ((0x09 == op || 0x19 == op) && regs.get(rs, off, &v))
+        {
+            add_ref(job, regs.first[rs], (v + sext(imm, 16)) & 0xFFFFFFFF, 4, 1);
+        }
+    }
+}
+
+//--------------------------------------------------------------------------
+// lui, addi/c.li from x0, and lui followed by addi, addiw, c.addi or
+// c.addiw reading the same register
+static void decode_riscv(risc_job_t &job)
+{
+    const seg_slice_t &slice = job.slice;
+    const size_t limit = get_limit(slice);
+    const bool rv64 = (2 == slice.bitness);
+
+    risc_regs_t regs;
+    for (size_t off = get_aligned_start(slice, 2); off + 2 <= limit; )
+    {
+        uint32 hw = read16(slice.buf + off, false);
+        uint64 v;
+        if ((hw & 3) != 3)
+        {
+            // c.li, c.addi, c.addiw on RV64 (c.jal on RV32)
+            int funct3 = hw >> 13;
+            int rd = (hw >> 7) & 31;
+            uint64 imm = sext((((hw >> 12) & 1) << 5) | ((hw >> 2) & 31), 6);
+            if ((hw & 3) == 1 && 2 == funct3 && 0 != rd && off < slice.size)
+            {
+                add_ref(job, off, imm & 0xFFFFFFFF, 2, 1);
+            }
+            else if ((hw & 3) == 1 && (0 == funct3 || (1 == funct3 && rv64)) && regs.get(rd, off, &v))
+            {
+                add_ref(job, regs.first[rd], (v + imm) & 0xFFFFFFFF, 2, 1);
+            }
+            off += 2;
+            continue;
+        }
+
+        if (off + 4 > limit)
+        {
+            break;
+        }
+
+        uint32 w = read32(slice.buf + off, false);
+        uint32 opcode = w & 0x7F;
+        int rd = (w >> 7) & 31;
+        int funct3 = (w >> 12) & 7;
+        int rs1 = (w >> 15) & 31;
+        if (0x37 == opcode)
+        {
+            if (off < slice.size)
+            {
+                regs.set(rd, w & 0xFFFFF000, off);
+                add_ref(job, off, w & 0xFFFFF000, 2, 1);
+            }
+        }
+        else if (0x13 == opcode && 0 == funct3 && 0 == rs1)
+        {
+            if (0 != rd && off < slice.size)
+            {
+                add_ref(job, off, sext(w >> 20, 12) & 0xFFFFFFFF, 2, 2);
+            }
+        }
+        else if ((0x13 == opcode || 0x1B == opcode) && 0 == funct3 && regs.get(rs1, off, &v))
+        {
+            add_ref(job, regs.first[rs1], (v + sext(w >> 20, 12)) & 0xFFFFFFFF, 2, 1);
+        }
+        off += 4;
+    }
+}
+
+//--------------------------------------------------------------------------
+static void idaapi risc_worker(void *ud, size_t idx)
+{
+    risc_job_t &job = ((risc_job_t *) ud)[idx];
+    int unit = 4;
+    switch (job.isa)
+    {
+        case ISA_ARM:
+            decode_arm(job);
+            unit = 2;
+            break;
+
+        case ISA_ARM64:
+            decode_arm64(job);
+            break;
+
+        case ISA_MIPS:
+            decode_mips(job);
+            break;
+
+        case ISA_RISCV:
+            decode_riscv(job);
+            unit = 2;
+            break;
+    }
+
+    // the values are found at the second instruction, the refs are at the first
+    struct ea_less_t
+    {
+        bool operator()(const imm_ref_t &a, const imm_ref_t &b) const { return a.ea < b.ea; }
+    };
+    std::stable_sort(job.refs.begin(), job.refs.end(), ea_less_t());
+    job.ninsns = (uint32) ((job.slice.size + unit - 1) / unit);
+}
+
+static int get_isa(const seg_slice_t &slice)
+{
+    switch (PH.id)
+    {
+        case PLFM_ARM:
+            return (2 == slice.bitness) ? ISA_ARM64 : ISA_ARM;
+
+        case PLFM_MIPS:
+            return ISA_MIPS;
+
+#ifdef PLFM_RISCV
+        case PLFM_RISCV:
+            return ISA_RISCV;
+#endif
+    }
+    return ISA_NONE;
+}
+
+//--------------------------------------------------------------------------
+bool is_risc_processor()
+{
+    seg_slice_t slice = {};
+    return ISA_NONE != get_isa(slice);
+}
+
+// collect the constants built by instruction pairs in the code segments of
+// the range. Only the values accepted by the filter are kept, the filter is
+// called from the worker threads.
+// returns false if cancelled by the user
+bool collect_risc_immediates(ea_t ea1, ea_t ea2, immvec_t &refs, imm_filter_t *filter)
+{
+    snapshotvec_t snapshots;
+    qvector<seg_slice_t> slices;
+
+    refs.clear();
+    if (!snapshot_segments(ea1, ea2, RISC_SLICE_SIZE, true, snapshots, slices))
+    {
+        return false;
+    }
+
+    qvector<risc_job_t> jobs;
+    for (size_t i = 0; i < slices.size(); ++i)
+    {
+        risc_job_t &job = jobs.push_back();
+        job.slice = slices[i];
+        job.isa = get_isa(slices[i]);
+        job.be = inf.is_be();
+        job.filter = filter;
+        job.ninsns = 0;
+    }
+
+    run_workers(risc_worker, jobs.begin(), jobs.size());
+
+    uint32 base = 0;
+    for (size_t i = 0; i < jobs.size(); ++i)
+    {
+        const immvec_t &local = jobs[i].refs;
+        for (size_t j = 0; j < local.size(); ++j)
+        {
+            imm_ref_t &ref = refs.push_back();
+            ref = local[j];
+            ref.insn += base;
+        }
+        base += jobs[i].ninsns;
+    }
+
+    return true;
+}
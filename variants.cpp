@@ -0,0 +1,240 @@
+// Derived forms of the crypto constants
+//
+// Compilers and hand written code rarely keep a constant as is: TEA_DELTA
+// 0x9E3779B9 is often added as its negation 0x61C88647, "x % 65521" becomes
+// a multiplication by 0x80078071, big endian code keeps the byte swapped
+// form... Each constant is expanded into these forms when the signatures
+// are compiled, and every form is tagged with the transform that made it.
+
+#include <pro.h>
+
+#include "findcrypt3.hpp"
+
+static const char *const variant_names[VAR_COUNT] =
+{
+    "",
+    "neg",
+    "not",
+    "bswap",
+    "rol8",
+    "rol16",
+    "rol24",
+    "rol32",
+    "udiv magic",
+    "sdiv magic",
+};
+
+const char *variant_name(int type)
+{
+    return (type >= 0 && type < VAR_COUNT) ? variant_names[type] : "?";
+}
+
+//--------------------------------------------------------------------------
+static uint64 mask_value(uint64 v, size_t elsize)
+{
+    return (elsize >= 8) ? v : (v & ((W64LIT(1) << (elsize * 8)) - 1));
+}
+
+static uint64 bswap_value(uint64 v, size_t elsize)
+{
+    uint64 r = 0;
+    for (size_t i = 0; i < elsize; ++i)
+    {
+        r = (r << 8) | ((v >> (i * 8)) & 0xFF);
+    }
+    return r;
+}
+
+static uint64 rol_value(uint64 v, size_t elsize, int bits)
+{
+    int width = (int) elsize * 8;
+    return mask_value((v << bits) | (v >> (width - bits)), elsize);
+}
+
+//--------------------------------------------------------------------------
+// magic multiplier used by compilers for the unsigned 32-bit division x / d
+// (choose_multiplier of GCC). Only the low 32 bits are returned if the
+// multiplier needs 33 bits, this is the immediate of the "add" sequence.
+static bool udiv_magic(uint32 d, uint32 *magic)
+{
+    if (d < 3 || d >= 0x80000000 || 0 == (d & (d - 1)))
+    {
+        return false;
+    }
+
+    int lgup = 0;
+    while ((W64LIT(1) << lgup) < d)
+    {
+        ++lgup;
+    }
+
+    uint64 mlow  = (W64LIT(1) << (32 + lgup)) / d;
+    uint64 mhigh = ((W64LIT(1) << (32 + lgup)) + (W64LIT(1) << lgup)) / d;
+    for (int shift = lgup; (mlow >> 1) < (mhigh >> 1) && shift > 0; --shift)
+    {
+        mlow >>= 1;
+        mhigh >>= 1;
+    }
+
+    *magic = (uint32) mhigh;
+    return true;
+}
+
+// magic multiplier for the signed 32-bit division x / d (Hacker's Delight)
+static bool sdiv_magic(uint32 d, uint32 *magic)
+{
+    if (d < 3 || d >= 0x80000000 || 0 == (d & (d - 1)))
+    {
+        return false;
+    }
+
+    const uint64 two31 = W64LIT(0x80000000);
+    uint64 anc = two31 - 1 - (two31 % d);
+    uint64 q1 = two31 / anc, r1 = two31 - q1 * anc;
+    uint64 q2 = two31 / d,   r2 = two31 - q2 * d;
+    uint64 delta;
+    do
+    {
+        q1 *= 2;
+        r1 *= 2;
+        if (r1 >= anc)
+        {
+            q1++;
+            r1 -= anc;
+        }
+
+        q2 *= 2;
+        r2 *= 2;
+        if (r2 >= d)
+        {
+            q2++;
+            r2 -= d;
+        }
+
+        delta = d - r2;
+    }
+    while (q1 < delta || (q1 == delta && 0 == r1));
+
+    *magic = (uint32) (q2 + 1);
+    return true;
+}
+
+//--------------------------------------------------------------------------
+// apply the transform to one element, returns false if it does not apply
+static bool transform_value(uint64 v, size_t elsize, size_t count, int type, uint64 *out)
+{
+    uint32 magic;
+    switch (type)
+    {
+        case VAR_NONE:
+            *out = v;
+            return true;
+
+        case VAR_NEG:
+            *out = mask_value(0 - v, elsize);
+            return true;
+
+        case VAR_NOT:
+            *out = mask_value(~v, elsize);
+            return true;
+
+        case VAR_BSWAP:
+            if (elsize < 2)
+            {
+                return false;
+            }
+            *out = bswap_value(v, elsize);
+            return true;
+
+        case VAR_ROL8:
+        case VAR_ROL16:
+        case VAR_ROL24:
+            if (4 != elsize)
+            {
+                return false;
+            }
+            *out = rol_value(v, elsize, (type - VAR_ROL8 + 1) * 8);
+            return true;
+
+        case VAR_ROL32:
+            if (8 != elsize)
+            {
+                return false;
+            }
+            *out = rol_value(v, elsize, 32);
+            return true;
+
+        case VAR_UDIV:
+        case VAR_SDIV:
+            // only single divisors like Adler32_BASE
+            if (4 != elsize || 1 != count)
+            {
+                return false;
+            }
+            if (!(VAR_UDIV == type ? udiv_magic((uint32) v, &magic) : sdiv_magic((uint32) v, &magic)))
+            {
+                return false;
+            }
+            *out = magic;
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+static uint64 get_element(const array_info_t *ai, size_t i)
+{
+    const uchar *ptr = (const uchar *) ai->array + i * ai->elsize;
+    switch (ai->elsize)
+    {
+        case 1: return *ptr;
+        case 2: return *(const word16 *) ptr;
+        case 4: return *(const word32 *) ptr;
+        case 8: return *(const word64 *) ptr;
+    }
+    return 0;
+}
+
+//--------------------------------------------------------------------------
+// append the array and all its distinct derived forms to out,
+// the first one is always the array itself (VAR_NONE)
+void expand_variants(const array_info_t *ai, variantvec_t &out)
+{
+    const size_t first = out.size();
+    for (int type = VAR_NONE; type < VAR_COUNT; ++type)
+    {
+        variant_t var;
+        var.ai = ai;
+        var.type = type;
+        var.values.resize(ai->size);
+
+        size_t i;
+        for (i = 0; i < ai->size; ++i)
+        {
+            if (!transform_value(get_element(ai, i), ai->elsize, ai->size, type, &var.values[i]))
+            {
+                break;
+            }
+        }
+
+        if (i != ai->size)
+        {
+            continue;
+        }
+
+        // rol16 of 0x00010001, bswap of 0x5A5A5A5A...
+        for (i = first; i < out.size(); ++i)
+        {
+            if (out[i].values == var.values)
+            {
+                break;
+            }
+        }
+
+        if (i == out.size())
+        {
+            out.push_back(var);
+        }
+    }
+}
@@ -0,0 +1,75 @@
+// Worker threads for the scanning passes
+//
+// The workers never call the IDA API: the main thread takes snapshots of
+// the database bytes first, the workers only read these buffers.
+
+#include <pro.h>
+
+#include <atomic>
+#include <thread>
+
+#include "findcrypt3.hpp"
+
+#define MAX_WORKERS     32
+
+struct worker_ctx_t
+{
+    worker_fn_t *fn;
+    void *ud;
+    size_t count;
+    std::atomic<size_t> next;
+};
+
+static int idaapi worker_thread(void *ud)
+{
+    worker_ctx_t *ctx = (worker_ctx_t *) ud;
+    for (size_t i = ctx->next++; i < ctx->count; i = ctx->next++)
+    {
+        ctx->fn(ctx->ud, i);
+    }
+    return 0;
+}
+
+//--------------------------------------------------------------------------
+size_t get_worker_count()
+{
+    size_t n = std::thread::hardware_concurrency();
+    return qmax(qmin(n, (size_t) MAX_WORKERS), (size_t) 1);
+}
+
+//--------------------------------------------------------------------------
+// run fn(ud, i) for all i in [0, count), the jobs are shared by the workers
+void run_workers(worker_fn_t *fn, void *ud, size_t count)
+{
+    worker_ctx_t ctx;
+    ctx.fn = fn;
+    ctx.ud = ud;
+    ctx.count = count;
+    ctx.next = 0;
+
+    size_t nthreads = qmin(get_worker_count(), count);
+    if (nthreads <= 1)
+    {
+        worker_thread(&ctx);
+        return;
+    }
+
+    qvector<qthread_t> threads;
+    for (size_t i = 1; i < nthreads; ++i)
+    {
+        qthread_t t = qthread_create(worker_thread, &ctx);
+        if (nullptr != t)
+        {
+            threads.push_back(t);
+        }
+    }
+
+    // the calling thread works too
+    worker_thread(&ctx);
+
+    for (size_t i = 0; i < threads.size(); ++i)
+    {
+        qthread_join(threads[i]);
+        qthread_free(threads[i]);
+    }
+}
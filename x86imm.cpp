@@ -0,0 +1,591 @@
+// Fast immediate extraction for x86/x64 code
+//
+// A table driven length decoder which only looks at the fields we need:
+// the immediates (imm8/16/32/64, sign extended as the CPU does) and the
+// 32-bit displacements (lea and memory operands, not rip relative ones).
+// The code segments are read into snapshot buffers, cut into slices at
+// instruction heads and the slices are decoded on worker threads.
+
+#include <pro.h>
+#include <ida.hpp>
+#include <idp.hpp>
+#include <ua.hpp>
+
+#include "findcrypt3.hpp"
+
+#define X86_SLICE_SIZE      0x100000    // bytes decoded by one job
+#define X86_MAX_INSN_LEN    15
+
+// immediate kinds
+#define I_NONE      0
+#define I_B         1       // imm8
+#define I_W         2       // imm16
+#define I_Z         3       // imm16/32 by operand size
+#define I_V         4       // imm16/32/64 by operand size (mov r, imm)
+#define I_REL8      5       // branch targets, not constants
+#define I_REL32     6
+#define I_ENTER     7       // iw + ib
+#define I_RETN      8       // iw
+#define I_FAR       9       // ptr16:32
+#define I_MOFFS     10      // address sized moffs
+#define I_GRP3B     11      // test r/m8, imm8 if reg is 0 or 1
+#define I_GRP3Z     12      // test r/m, imm16/32 if reg is 0 or 1
+#define I_INVALID   13
+
+struct x86_op_info_t
+{
+    uchar modrm;
+    uchar imm;
+};
+
+//--------------------------------------------------------------------------
+// one byte opcode map
+static const x86_op_info_t op1[256] =
+{
+    // 00
+    { 1, I_NONE }, { 1, I_NONE }, { 1, I_NONE }, { 1, I_NONE }, { 0, I_B }, { 0, I_Z }, { 0, I_NONE }, { 0, I_NONE },
+    { 1, I_NONE }, { 1, I_NONE }, { 1, I_NONE }, { 1, I_NONE }, { 0, I_B }, { 0, I_Z }, { 0, I_NONE }, { 0, I_INVALID },
+    // 10
+    { 1, I_NONE }, { 1, I_NONE }, { 1, I_NONE }, { 1, I_NONE }, { 0, I_B }, { 0, I_Z }, { 0, I_NONE }, { 0, I_NONE },
+    { 1, I_NONE }, { 1, I_NONE }, { 1, I_NONE }, { 1, I_NONE }, { 0, I_B }, { 0, I_Z }, { 0, I_NONE }, { 0, I_NONE },
+    // 20
+    { 1, I_NONE }, { 1, I_NONE }, { 1, I_NONE }, { 1, I_NONE }, { 0, I_B }, { 0, I_Z }, { 0, I_INVALID }, { 0, I_NONE },
+    { 1, I_NONE }, { 1, I_NONE }, { 1, I_NONE }, { 1, I_NONE }, { 0, I_B }, { 0, I_Z }, { 0, I_INVALID }, { 0, I_NONE },
+    // 30
+    { 1, I_NONE }, { 1, I_NONE }, { 1, I_NONE }, { 1, I_NONE }, { 0, I_B }, { 0, I_Z }, { 0, I_INVALID }, { 0, I_NONE },
+    { 1, I_NONE }, { 1, I_NONE }, { 1, I_NONE }, { 1, I_NONE }, { 0, I_B }, { 0, I_Z }, { 0, I_INVALID }, { 0, I_NONE },
+    // 40
+    { 0, I_NONE }, { 0, I_NONE }, { 0, I_NONE }, { 0, I_NONE }, { 0, I_NONE }, { 0, I_NONE }, { 0, I_NONE }, { 0, I_NONE },
+    { 0, I_NONE }, { 0, I_NONE }, { 0, I_NONE }, { 0, I_NONE }, { 0, I_NONE }, { 0, I_NONE }, { 0, I_NONE }, { 0, I_NONE },
+    // 50
+    { 0, I_NONE }, { 0, I_NONE }, { 0, I_NONE }, { 0, I_NONE }, { 0, I_NONE }, { 0, I_NONE }, { 0, I_NONE }, { 0, I_NONE },
+    { 0, I_NONE }, { 0, I_NONE }, { 0, I_NONE }, { 0, I_NONE }, { 0, I_NONE }, { 0, I_NONE }, { 0, I_NONE }, { 0, I_NONE },
+    // 60
+    { 0, I_NONE }, { 0, I_NONE }, { 1, I_NONE }, { 1, I_NONE }, { 0, I_INVALID }, { 0, I_INVALID }, { 0, I_INVALID }, { 0, I_INVALID },
+    { 0, I_Z }, { 1, I_Z }, { 0, I_B }, { 1, I_B }, { 0, I_NONE }, { 0, I_NONE }, { 0, I_NONE }, { 0, I_NONE },
+    // 70
+    { 0, I_REL8 }, { 0, I_REL8 }, { 0, I_REL8 }, { 0, I_REL8 }, { 0, I_REL8 }, { 0, I_REL8 }, { 0, I_REL8 }, { 0, I_REL8 },
+    { 0, I_REL8 }, { 0, I_REL8 }, { 0, I_REL8 }, { 0, I_REL8 }, { 0, I_REL8 }, { 0, I_REL8 }, { 0, I_REL8 }, { 0, I_REL8 },
+    // 80
+    { 1, I_B }, { 1, I_Z }, { 1, I_B }, { 1, I_B }, { 1, I_NONE }, { 1, I_NONE }, { 1, I_NONE }, { 1, I_NONE },
+    { 1, I_NONE }, { 1, I_NONE }, { 1, I_NONE }, { 1, I_NONE }, { 1, I_NONE }, { 1, I_NONE }, { 1, I_NONE }, { 1, I_NONE },
+    // 90
+    { 0, I_NONE }, { 0, I_NONE }, { 0, I_NONE }, { 0, I_NONE }, { 0, I_NONE }, { 0, I_NONE }, { 0, I_NONE }, { 0, I_NONE },
+    { 0, I_NONE }, { 0, I_NONE }, { 0, I_FAR }, { 0, I_NONE }, { 0, I_NONE }, { 0, I_NONE }, { 0, I_NONE }, { 0, I_NONE },
+    // A0
+    { 0, I_MOFFS }, { 0, I_MOFFS }, { 0, I_MOFFS }, { 0, I_MOFFS }, { 0, I_NONE }, { 0, I_NONE }, { 0, I_NONE }, { 0, I_NONE },
+    { 0, I_B }, { 0, I_Z }, { 0, I_NONE }, { 0, I_NONE }, { 0, I_NONE }, { 0, I_NONE }, { 0, I_NONE }, { 0, I_NONE },
+    // B0
+    { 0, I_B }, { 0, I_B }, { 0, I_B }, { 0, I_B }, { 0, I_B }, { 0, I_B }, { 0, I_B }, { 0, I_B },
+    { 0, I_V }, { 0, I_V }, { 0, I_V }, { 0, I_V }, { 0, I_V }, { 0, I_V }, { 0, I_V }, { 0, I_V },
+    // C0
+    { 1, I_B }, { 1, I_B }, { 0, I_RETN }, { 0, I_NONE }, { 1, I_NONE }, { 1, I_NONE }, { 1, I_B }, { 1, I_Z },
+    { 0, I_ENTER }, { 0, I_NONE }, { 0, I_RETN }, { 0, I_NONE }, { 0, I_NONE }, { 0, I_B }, { 0, I_NONE }, { 0, I_NONE },
+    // D0
+    { 1, I_NONE }, { 1, I_NONE }, { 1, I_NONE }, { 1, I_NONE }, { 0, I_B }, { 0, I_B }, { 0, I_NONE }, { 0, I_NONE },
+    { 1, I_NONE }, { 1, I_NONE }, { 1, I_NONE }, { 1, I_NONE }, { 1, I_NONE }, { 1, I_NONE }, { 1, I_NONE }, { 1, I_NONE },
+    // E0
+    { 0, I_REL8 }, { 0, I_REL8 }, { 0, I_REL8 }, { 0, I_REL8 }, { 0, I_B }, { 0, I_B }, { 0, I_B }, { 0, I_B },
+    { 0, I_REL32 }, { 0, I_REL32 }, { 0, I_FAR }, { 0, I_REL8 }, { 0, I_NONE }, { 0, I_NONE }, { 0, I_NONE }, { 0, I_NONE },
+    // F0
+    { 0, I_INVALID }, { 0, I_NONE }, { 0, I_INVALID }, { 0, I_INVALID }, { 0, I_NONE }, { 0, I_NONE }, { 1, I_GRP3B }, { 1, I_GRP3Z },
+    { 0, I_NONE }, { 0, I_NONE }, { 0, I_NONE }, { 0, I_NONE }, { 0, I_NONE }, { 0, I_NONE }, { 1, I_NONE }, { 1, I_NONE },
+};
+
+//--------------------------------------------------------------------------
+// two byte opcode map (0F xx): 1 = modrm, 2 = modrm + imm8, 3 = rel32, 0 = none
+static const uchar op2[256] =
+{
+    1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 2,     // 00
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,     // 10
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,     // 20
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,     // 30
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,     // 40
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,     // 50
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,     // 60
+    2, 2, 2, 2, 1, 1, 1, 0, 1, 1, 1, 1, 1, 1, 1, 1,     // 70
+    3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,     // 80
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,     // 90
+    0, 0, 0, 1, 2, 1, 0, 0, 0, 0, 0, 1, 2, 1, 1, 1,     // A0
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1,     // B0
+    1, 1, 2, 1, 2, 2, 2, 1, 0, 0, 0, 0, 0, 0, 0, 0,     // C0
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,     // D0
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,     // E0
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,     // F0
+};
+
+// VEX/EVEX map 1 opcodes with an imm8
+static bool map1_has_imm8(uchar op)
+{
+    return (op >= 0x70 && op <= 0x73) || op == 0xC2 || (op >= 0xC4 && op <= 0xC6);
+}
+
+//--------------------------------------------------------------------------
+// IDA operand numbers of the constant fields: the explicit operands in the
+// Intel order, the ModRM reg operand, the VEX register, r/m and imm8
+
+// the ModRM reg field is an operand, not an opcode extension
+static bool has_reg_operand(uchar map, uchar op)
+{
+    if (0 == map)
+        return !((op >= 0x80 && op <= 0x83) || op == 0x8F || op == 0xC0 || op == 0xC1 || op == 0xC6 || op == 0xC7
+              || (op >= 0xD0 && op <= 0xDF) || op == 0xF6 || op == 0xF7 || op == 0xFE || op == 0xFF);
+    if (1 == map)
+        return !(op == 0x00 || op == 0x01 || op == 0x0D || (op >= 0x18 && op <= 0x1F) || (op >= 0x71 && op <= 0x73)
+              || op == 0xAE || op == 0xBA || op == 0xC7);
+    return true;
+}
+
+// the r/m operand comes first: stores and read-modify-write forms
+static bool rm_is_first(uchar map, uchar op, bool is64)
+{
+    switch (map)
+    {
+        case 0:
+            if (op < 0x40)
+                return (op & 2) == 0;
+            if (op == 0x63)
+                return !is64;   // arpl, movsxd in 64-bit mode
+            return !(op == 0x62 || op == 0x69 || op == 0x6B || op == 0x8A || op == 0x8B || op == 0x8D
+                  || op == 0x8E || op == 0xC4 || op == 0xC5);
+        case 1:
+            return !has_reg_operand(map, op) || op == 0x11 || op == 0x13 || op == 0x17 || op == 0x29 || op == 0x2B
+                || op == 0x7E || op == 0x7F || (op >= 0x90 && op <= 0x9F) || op == 0xA3 || op == 0xA4 || op == 0xA5
+                || op == 0xAB || op == 0xAC || op == 0xAD || op == 0xB0 || op == 0xB1 || op == 0xB3 || op == 0xBB
+                || op == 0xC0 || op == 0xC1 || op == 0xC3 || op == 0xD6 || op == 0xE7;
+        case 2:
+            return op == 0x2E || op == 0x2F || op == 0x8E || op == 0xF1;
+        default:
+            return (op >= 0x14 && op <= 0x17) || op == 0x19 || op == 0x1D || op == 0x39 || op == 0x3B;
+    }
+}
+
+// operand number of an immediate without ModRM
+static uchar imm_operand(uchar op)
+{
+    // push, int, aam, aad and out have it first
+    return (op == 0x68 || op == 0x6A || op == 0xCD || op == 0xD4 || op == 0xD5 || op == 0xE6 || op == 0xE7) ? 0 : 1;
+}
+
+static inline uint64 read_le(const uchar *p, int size)
+{
+    uint64 v = 0;
+    for (int i = size - 1; i >= 0; --i)
+    {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+static inline uint64 sign_extend(uint64 v, int from, int to)
+{
+    uint64 sign = W64LIT(1) << (from * 8 - 1);
+    v = (v ^ sign) - sign;
+    return (to >= 8) ? v : (v & ((W64LIT(1) << (to * 8)) - 1));
+}
+
+//--------------------------------------------------------------------------
+// decode the length of one instruction and collect its constant fields,
+// insn may be nullptr
+// returns 0 for invalid or truncated instructions
+struct x86_field_t
+{
+    uint64 value;
+    uchar type;                 // o_imm or o_displ
+    uchar n;                    // IDA operand number
+};
+
+static size_t x86_decode(const uchar *p, size_t avail, bool is64, x86_field_t *fields, int *nfields, x86_insn_t *insn)
+{
+    const uchar *start = p;
+    const uchar *end = p + qmin(avail, (size_t) X86_MAX_INSN_LEN);
+    bool opsize16 = false;
+    bool addr16 = false;
+    bool addr32 = false;
+    bool rexw = false;
+
+    *nfields = 0;
+
+    // legacy prefixes and REX
+    for (; p < end; ++p)
+    {
+        uchar b = *p;
+        if (b == 0x66)
+            opsize16 = true;
+        else if (b == 0x67)
+            (is64 ? addr32 : addr16) = true;
+        else if (b == 0xF0 || b == 0xF2 || b == 0xF3 || b == 0x26 || b == 0x2E
+              || b == 0x36 || b == 0x3E || b == 0x64 || b == 0x65)
+            rexw = false;
+        else if (is64 && (b & 0xF0) == 0x40)
+            rexw = (b & 8) != 0;
+        else
+            break;
+    }
+
+    if (p >= end)
+        return 0;
+
+    int opsize = rexw ? 8 : (opsize16 ? 2 : 4);
+    bool has_modrm = false;
+    int imm = I_NONE;
+    uchar op = *p++;
+    uchar map = 0;              // 0: one byte, 1: 0F, 2: 0F38, 3: 0F3A
+    bool vex = false;
+    bool nds = false;           // the VEX register is an operand
+
+    if (op == 0x0F)
+    {
+        if (p >= end)
+            return 0;
+
+        op = *p++;
+        if (op == 0x38 || op == 0x3A)
+        {
+            map = (op == 0x38) ? 2 : 3;
+            if (p >= end)
+                return 0;
+            op = *p++;
+        }
+        else
+        {
+            map = 1;
+        }
+    }
+    else if ((op == 0xC4 || op == 0xC5 || op == 0x62) && p < end && (is64 || (*p & 0xC0) == 0xC0))
+    {
+        // VEX2, VEX3 or EVEX
+        vex = true;
+        if (op == 0xC5)
+        {
+            map = 1;
+            nds = (p[0] & 0x78) != 0x78;
+            p += 1;
+        }
+        else if (op == 0xC4)
+        {
+            if (p + 2 > end)
+                return 0;
+            map = p[0] & 0x1F;
+            rexw = (p[1] & 0x80) != 0;
+            nds = (p[1] & 0x78) != 0x78;
+            p += 2;
+        }
+        else
+        {
+            if (p + 3 > end)
+                return 0;
+            map = p[0] & 0x07;
+            nds = (p[1] & 0x78) != 0x78 || (p[2] & 0x08) == 0;
+            p += 3;
+
+            // the AVX512-FP16 maps have no imm8
+            if (map == 5 || map == 6)
+                map = 2;
+        }
+
+        if (map < 1 || map > 3 || p >= end)
+            return 0;
+
+        op = *p++;
+    }
+
+    if (0 == map)
+    {
+        has_modrm = op1[op].modrm != 0;
+        imm = op1[op].imm;
+
+        if (imm == I_INVALID)
+            return 0;
+
+        if (is64)
+        {
+            // invalid in 64-bit mode
+            if (op == 0x06 || op == 0x07 || op == 0x0E || op == 0x16 || op == 0x17 || op == 0x1E
+             || op == 0x1F || op == 0x27 || op == 0x2F || op == 0x37 || op == 0x3F || op == 0x60
+             || op == 0x61 || op == 0x82 || op == 0x9A || op == 0xD4 || op == 0xD5 || op == 0xEA)
+                return 0;
+        }
+    }
+    else if (1 == map)
+    {
+        if (vex)
+        {
+            has_modrm = (op != 0x77);
+            imm = map1_has_imm8(op) ? I_B : I_NONE;
+        }
+        else
+        {
+            has_modrm = op2[op] == 1 || op2[op] == 2;
+            imm = (op2[op] == 2) ? I_B : (op2[op] == 3 ? I_REL32 : I_NONE);
+        }
+    }
+    else
+    {
+        has_modrm = true;
+        imm = (3 == map) ? I_B : I_NONE;
+    }
+
+    // ModRM, SIB and displacement
+    uchar reg = 0;
+    uchar modrm = 0;
+    uchar nrm = 0;              // operand numbers of r/m and imm
+    uchar nimm = 0;
+    if (has_modrm)
+    {
+        uchar nreg = (has_reg_operand(map, op) ? 1 : 0) + (nds ? 1 : 0);
+        nrm = rm_is_first(map, op, is64) ? 0 : nreg;
+        nimm = nreg + 1;
+    }
+    else
+    {
+        nimm = imm_operand(op);
+    }
+
+    if (has_modrm)
+    {
+        if (p >= end)
+            return 0;
+
+        modrm = *p++;
+        uchar mod = modrm >> 6;
+        uchar rm = modrm & 7;
+        reg = (modrm >> 3) & 7;
+
+        int disp = 0;
+        bool riprel = false;
+        if (mod != 3)
+        {
+            if (addr16)
+            {
+                disp = (mod == 1) ? 1 : ((mod == 2 || (mod == 0 && rm == 6)) ? 2 : 0);
+            }
+            else
+            {
+                if (rm == 4)
+                {
+                    if (p >= end)
+                        return 0;
+                    uchar sib = *p++;
+                    if (mod == 0 && (sib & 7) == 5)
+                        disp = 4;
+                }
+                else if (mod == 0 && rm == 5)
+                {
+                    disp = 4;
+                    riprel = is64 && !addr32;
+                }
+
+                if (mod == 1)
+                    disp = 1;
+                else if (mod == 2)
+                    disp = 4;
+            }
+        }
+
+        if (p + disp > end)
+            return 0;
+
+        if (disp == 4 && !riprel)
+        {
+            x86_field_t &f = fields[(*nfields)++];
+            f.value = sign_extend(read_le(p, 4), 4, is64 ? 8 : 4);
+            f.type = o_displ;
+            f.n = nrm;
+        }
+        p += disp;
+    }
+
+    // immediate
+    int immsize = 0;
+    int valsize = opsize;
+    bool constant = true;
+    switch (imm)
+    {
+        case I_B:
+            immsize = 1;
+            // mov r8, imm8 and the byte forms: the value is not extended
+            if ((0 == map && (op & 0xF0) == 0xB0) || (0 == map && (op == 0x80 || op == 0xC6 || op == 0xA8 || (op & 0xC7) == 0x04)))
+                valsize = 1;
+            break;
+        case I_W:
+            immsize = 2;
+            break;
+        case I_Z:
+            immsize = opsize16 ? 2 : 4;
+            break;
+        case I_V:
+            immsize = opsize;
+            break;
+        case I_GRP3B:
+            if (reg < 2)
+            {
+                immsize = 1;
+                valsize = 1;
+            }
+            break;
+        case I_GRP3Z:
+            if (reg < 2)
+                immsize = opsize16 ? 2 : 4;
+            break;
+        case I_REL8:
+            immsize = 1;
+            constant = false;
+            break;
+        case I_REL32:
+            immsize = (opsize16 && !is64) ? 2 : 4;
+            constant = false;
+            break;
+        case I_ENTER:
+            immsize = 3;
+            constant = false;
+            break;
+        case I_RETN:
+            immsize = 2;
+            constant = false;
+            break;
+        case I_FAR:
+            immsize = (opsize16 ? 2 : 4) + 2;
+            constant = false;
+            break;
+        case I_MOFFS:
+            immsize = is64 ? (addr32 ? 4 : 8) : (addr16 ? 2 : 4);
+            constant = false;
+            break;
+        default:
+            break;
+    }
+
+    if (p + immsize > end)
+        return 0;
+
+    if (immsize > 0 && constant)
+    {
+        x86_field_t &f = fields[(*nfields)++];
+        f.value = sign_extend(read_le(p, immsize), immsize, valsize);
+        f.type = o_imm;
+        f.n = nimm;
+    }
+
+    if (nullptr != insn)
+    {
+        insn->map = map;
+        insn->op = op;
+        insn->modrm = modrm;
+        insn->has_modrm = has_modrm;
+        insn->vex = vex;
+        insn->is_rel = (imm == I_REL8 || imm == I_REL32);
+        insn->rel = insn->is_rel ? (sval_t) sign_extend(read_le(p, immsize), immsize, 8) : 0;
+    }
+    p += immsize;
+
+    return p - start;
+}
+
+//--------------------------------------------------------------------------
+// length and opcode of one instruction, for the other byte scanners
+// returns 0 for invalid or truncated instructions
+size_t x86_insn_length(const uchar *p, size_t avail, bool is64, x86_insn_t *insn)
+{
+    x86_field_t fields[2];
+    int nfields;
+    return x86_decode(p, avail, is64, fields, &nfields, insn);
+}
+
+//--------------------------------------------------------------------------
+// one slice of a code segment snapshot
+struct x86_job_t
+{
+    seg_slice_t slice;
+    imm_filter_t *filter;
+    immvec_t refs;              // insn = sequence number in the slice
+    uint32 ninsns;
+};
+DECLARE_TYPE_AS_MOVABLE(x86_job_t);
+
+static void idaapi x86_worker(void *ud, size_t idx)
+{
+    x86_job_t &job = ((x86_job_t *) ud)[idx];
+    const seg_slice_t &slice = job.slice;
+    const bool is64 = (2 == slice.bitness);
+    x86_field_t fields[2];
+    int nfields;
+
+    job.ninsns = 0;
+    for (size_t off = 0; off < slice.size; )
+    {
+        size_t len = x86_decode(slice.buf + off, slice.avail - off, is64, fields, &nfields, nullptr);
+        if (0 == len)
+        {
+            off++;
+            continue;
+        }
+
+        for (int i = 0; i < nfields; ++i)
+        {
+            if (nullptr != job.filter && !job.filter(fields[i].value))
+            {
+                continue;
+            }
+
+            imm_ref_t &ref = job.refs.push_back();
+            ref.ea = slice.ea + off;
+            ref.value = fields[i].value;
+            ref.insn = job.ninsns;
+            ref.n = fields[i].n;
+            ref.type = fields[i].type;
+        }
+
+        job.ninsns++;
+        off += len;
+    }
+}
+
+//--------------------------------------------------------------------------
+// collect the immediates and displacements of the x86/x64 code segments in
+// the range. Only the values accepted by the filter are kept, the filter is
+// called from the worker threads.
+// returns false if cancelled by the user
+bool collect_x86_immediates(ea_t ea1, ea_t ea2, immvec_t &refs, imm_filter_t *filter)
+{
+    snapshotvec_t snapshots;
+    qvector<seg_slice_t> slices;
+
+    refs.clear();
+    if (!snapshot_segments(ea1, ea2, X86_SLICE_SIZE, true, snapshots, slices))
+    {
+        return false;
+    }
+
+    qvector<x86_job_t> jobs;
+    for (size_t i = 0; i < slices.size(); ++i)
+    {
+        // no 16-bit code
+        if (0 == slices[i].bitness)
+        {
+            continue;
+        }
+
+        x86_job_t &job = jobs.push_back();
+        job.slice = slices[i];
+        job.filter = filter;
+        job.ninsns = 0;
+    }
+
+    run_workers(x86_worker, jobs.begin(), jobs.size());
+
+    uint32 base = 0;
+    for (size_t i = 0; i < jobs.size(); ++i)
+    {
+        const immvec_t &local = jobs[i].refs;
+        for (size_t j = 0; j < local.size(); ++j)
+        {
+            imm_ref_t &ref = refs.push_back();
+            ref = local[j];
+            ref.insn += base;
+        }
+        base += jobs[i].ninsns;
+    }
+
+    return true;
+}